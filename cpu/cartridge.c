@@ -0,0 +1,378 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+#include <pthread.h>
+
+struct cartridge cartridge;
+
+void (*mapper_write)(uint16_t address, uint8_t data);
+uint8_t (*mapper_read)(uint16_t address);
+void (*mapper_ppu_changed)(uint8_t ctrl, uint8_t mask);
+void (*mapper_irq)();
+int (*mapper_audio)();
+
+/* The ROM and the hooks come with the cartridge an instance loaded, so a
+ * snapshot only keeps which banks are mapped. restore_banks points the
+ * slots back at them after a load. */
+const struct state_chunk cartridge_state[] = {
+  {&cartridge, offsetof(struct cartridge, banks), STATE_CONTEXT},
+  {&cartridge.banks, sizeof(cartridge.banks), STATE_ALL},
+  {&mapper_write, sizeof(mapper_write), STATE_CONTEXT},
+  {&mapper_read, sizeof(mapper_read), STATE_CONTEXT},
+  {&mapper_ppu_changed, sizeof(mapper_ppu_changed), STATE_CONTEXT},
+  {&mapper_irq, sizeof(mapper_irq), STATE_CONTEXT},
+  {&mapper_audio, sizeof(mapper_audio), STATE_CONTEXT},
+  STATE_END
+};
+
+/* Perfect hash tables generated from gamedb by gamedb_generator.py */
+extern const int gamedb_buckets;
+extern const uint32_t gamedb_mask;
+extern const uint32_t gamedb_seeds[];
+extern const struct game_entry gamedb_entries[];
+
+/* Images loaded through the cache, keyed by the CRC of the whole file */
+static struct rom_image* rom_cache;
+static pthread_mutex_t rom_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int load(const uint8_t* data, size_t size, struct rom_image* image);
+
+/* Load an iNES image. Call after initialize_cpu. */
+int load_rom(const uint8_t* data, size_t size)
+{
+  return load(data, size, NULL);
+}
+
+/* Load a cached image without copying its ROM. Takes over the caller's
+ * reference. */
+int load_image(struct rom_image* image)
+{
+  return load(image->data, image->size, image);
+}
+
+/* Read an iNES header and apply the database corrections. RAM sizes come
+ * back in KB like the database's. */
+int rom_info(const uint8_t* data, size_t size, struct game_entry* info)
+{
+  if (size < INES_HEADER_SIZE || memcmp(data, "NES\x1A", 4))
+  {
+    return -1;
+  }
+
+  size_t offset = INES_HEADER_SIZE + ((data[6] & 0x04) ? INES_TRAINER_SIZE : 0);
+  size_t prg_size = data[4] * 0x4000;
+  size_t chr_size = data[5] * 0x2000;
+  if (!prg_size || offset + prg_size + chr_size > size)
+  {
+    return -1;
+  }
+
+  info->crc = rom_crc32(0, data + offset, prg_size + chr_size);
+  info->mapper = (data[6] >> 4) | (data[7] & 0xF0);
+  info->submapper = 0;
+  info->mirroring = (data[6] & 0x08) ? mirroring_four_screen : (data[6] & 0x01) ? mirroring_vertical : mirroring_horizontal;
+  info->prg_ram = (data[8] ? data[8] : 1) * 8;
+  info->chr_ram = chr_size ? 0 : 8;
+  info->region = (data[9] & 0x01) ? region_pal : region_ntsc;
+  info->valid = 1;
+
+  /* Headers in the wild are often wrong, the database knows better */
+  const struct game_entry* entry = gamedb_lookup(info->crc);
+  if (entry)
+  {
+    *info = *entry;
+  }
+
+  return 0;
+}
+
+static int load(const uint8_t* data, size_t size, struct rom_image* image)
+{
+  struct game_entry info;
+  if (rom_info(data, size, &info))
+  {
+    if (image)
+    {
+      rom_cache_release(image);
+    }
+    return -1;
+  }
+
+  unload_rom();
+  cartridge.image = image;
+
+  size_t offset = INES_HEADER_SIZE + ((data[6] & 0x04) ? INES_TRAINER_SIZE : 0);
+  cartridge.prg_size = data[4] * 0x4000;
+  cartridge.chr_size = data[5] * 0x2000;
+  cartridge.crc = info.crc;
+  cartridge.mapper = info.mapper;
+  cartridge.submapper = info.submapper;
+  cartridge.vertical_mirroring = info.mirroring == mirroring_vertical;
+  cartridge.four_screen = info.mirroring == mirroring_four_screen;
+  cartridge.prg_ram_size = info.prg_ram * 0x400;
+  cartridge.chr_ram_size = info.chr_ram * 0x400;
+  cartridge.region = info.region;
+  set_region(info.region);
+
+  /* Boards without CHR-ROM get CHR-RAM, 8KB unless the database says otherwise */
+  if (!cartridge.chr_size && cartridge.chr_ram_size < 0x2000)
+  {
+    cartridge.chr_ram_size = 0x2000;
+  }
+
+  if (image)
+  {
+    /* ROM is never written, so cached images are used in place */
+    cartridge.prg_rom = (uint8_t*) data + offset;
+    cartridge.chr_rom = cartridge.chr_size ? (uint8_t*) data + offset + cartridge.prg_size :
+      calloc(cartridge.chr_ram_size, 1);
+  }
+  else
+  {
+    cartridge.prg_rom = malloc(cartridge.prg_size);
+    memcpy(cartridge.prg_rom, data + offset, cartridge.prg_size);
+    cartridge.chr_rom = calloc(cartridge.chr_size ? cartridge.chr_size : cartridge.chr_ram_size, 1);
+    memcpy(cartridge.chr_rom, data + offset + cartridge.prg_size, cartridge.chr_size);
+  }
+
+  for (int slot = 0; slot < 8; slot++)
+  {
+    map_chr(slot, slot);
+  }
+
+  switch (cartridge.mapper) {
+    case 0:
+      /* NROM-128 mirrors its single 16KB bank */
+      map_prg(0, 0);
+      map_prg(1, 1);
+      map_prg(2, 2);
+      map_prg(3, 3);
+      break;
+    case 4:
+      mmc3_init();
+      break;
+    case 5:
+      mmc5_init();
+      break;
+    case 19:
+      n163_init();
+      break;
+    case 24:
+    case 26:
+      vrc6_init(cartridge.mapper == 26);
+      break;
+    case 69:
+      fme7_init();
+      break;
+    case 85:
+      vrc7_init();
+      break;
+    default:
+      unload_rom();
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Reflected CRC-32 as used by zip and the ROM databases, eight bytes per
+ * step with the slicing-by-8 tables */
+uint32_t rom_crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+  const uint32_t* t = crc32_tables;
+  crc = ~crc;
+
+  for (; size >= 8; size -= 8, data += 8)
+  {
+    uint32_t low = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+    uint32_t high = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t) data[7] << 24;
+    crc = t[7 * 256 + (low & 0xFF)] ^ t[6 * 256 + ((low >> 8) & 0xFF)] ^
+      t[5 * 256 + ((low >> 16) & 0xFF)] ^ t[4 * 256 + (low >> 24)] ^
+      t[3 * 256 + (high & 0xFF)] ^ t[2 * 256 + ((high >> 8) & 0xFF)] ^
+      t[1 * 256 + ((high >> 16) & 0xFF)] ^ t[high >> 24];
+  }
+
+  for (; size; size--, data++)
+  {
+    crc = (crc >> 8) ^ t[(crc ^ *data) & 0xFF];
+  }
+
+  return ~crc;
+}
+
+/* Murmur3 finalizer, must match fmix in gamedb_generator.py */
+static uint32_t gamedb_hash(uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+/* One probe into the perfect hash, NULL when the ROM is not in the database */
+const struct game_entry* gamedb_lookup(uint32_t crc)
+{
+  const struct game_entry* entry = &gamedb_entries[gamedb_hash(crc ^ gamedb_seeds[crc % gamedb_buckets]) & gamedb_mask];
+  return entry->valid && entry->crc == crc ? entry : NULL;
+}
+
+/* Call with the cache locked */
+static struct rom_image* rom_cache_find(uint32_t crc, size_t size)
+{
+  struct rom_image* image = rom_cache;
+  while (image && (image->crc != crc || image->size != size))
+  {
+    image = image->next;
+  }
+  return image;
+}
+
+/* Take a reference to a cached image, NULL when it is not cached */
+struct rom_image* rom_cache_acquire(uint32_t crc, size_t size)
+{
+  pthread_mutex_lock(&rom_cache_lock);
+  struct rom_image* image = rom_cache_find(crc, size);
+  if (image)
+  {
+    image->refs++;
+  }
+  pthread_mutex_unlock(&rom_cache_lock);
+  return image;
+}
+
+/* Cache a freshly loaded image and return a reference to it. If another
+ * thread cached the same file first, the new copy is freed and theirs is
+ * shared instead. */
+struct rom_image* rom_cache_insert(struct rom_image* image)
+{
+  pthread_mutex_lock(&rom_cache_lock);
+  struct rom_image* cached = rom_cache_find(image->crc, image->size);
+  if (cached)
+  {
+    free(image);
+    image = cached;
+    image->refs++;
+  }
+  else
+  {
+    image->refs = 1;
+    image->next = rom_cache;
+    rom_cache = image;
+  }
+  pthread_mutex_unlock(&rom_cache_lock);
+  return image;
+}
+
+/* Drop a reference, the last one frees the image */
+void rom_cache_release(struct rom_image* image)
+{
+  pthread_mutex_lock(&rom_cache_lock);
+  if (--image->refs == 0)
+  {
+    struct rom_image** link = &rom_cache;
+    while (*link != image)
+    {
+      link = &(*link)->next;
+    }
+    *link = image->next;
+    free(image);
+  }
+  pthread_mutex_unlock(&rom_cache_lock);
+}
+
+void unload_rom()
+{
+  if (cartridge.image)
+  {
+    if (!cartridge.chr_size)
+    {
+      free(cartridge.chr_rom);
+    }
+    rom_cache_release(cartridge.image);
+  }
+  else
+  {
+    free(cartridge.prg_rom);
+    free(cartridge.chr_rom);
+  }
+  memset(&cartridge, 0, sizeof(cartridge));
+  mapper_write = NULL;
+  mapper_read = NULL;
+  mapper_ppu_changed = NULL;
+  mapper_irq = NULL;
+  mapper_audio = NULL;
+
+  /* Cartridge space, above the page holding the input ports */
+  for (int page = INPUT_PAGE + 1; page < 0x100; page++)
+  {
+    read_pages[page] = memory + (page << 8);
+  }
+  HOOK_MAP(INPUT_PAGE + 1, 0xFF - INPUT_PAGE);
+
+  for (int slot = 0; slot < PRG_BANK_SLOTS; slot++)
+  {
+    cartridge.banks.prg[slot] = -1;
+  }
+}
+
+/* Point a slot's pages at a PRG-ROM offset, or at PRG-RAM for -1 */
+static void map_prg_offset(int slot, long offset)
+{
+  int first = (PRG_ROM >> 8) + slot * (PRG_BANK_SIZE >> 8);
+  cartridge.banks.prg[slot + 1] = offset;
+
+  for (int page = 0; page < PRG_BANK_SIZE >> 8; page++)
+  {
+    read_pages[first + page] = offset < 0 ? memory + ((first + page) << 8) :
+      cartridge.prg_rom + offset + (page << 8);
+  }
+
+  HOOK_MAP(first, PRG_BANK_SIZE >> 8);
+  cheat_map(first, PRG_BANK_SIZE >> 8);
+}
+
+/* Point one 8KB CPU slot at $8000 + slot * $2000 to a PRG bank, slot -1
+ * being $6000. Negative banks count from the end of the ROM. */
+void map_prg(int slot, int bank)
+{
+  int banks = cartridge.prg_size / PRG_BANK_SIZE;
+  bank = ((bank % banks) + banks) % banks;
+  map_prg_offset(slot, (long) bank * PRG_BANK_SIZE);
+}
+
+/* Point a slot at the PRG-RAM in the flat memory */
+void map_prg_ram(int slot)
+{
+  map_prg_offset(slot, -1);
+}
+
+/* Point one 1KB PPU slot at slot * $400 to a CHR bank */
+void map_chr(int slot, int bank)
+{
+  int banks = (cartridge.chr_size ? cartridge.chr_size : cartridge.chr_ram_size) / CHR_BANK_SIZE;
+  cartridge.banks.chr[slot] = (long) (bank % banks) * CHR_BANK_SIZE;
+  cartridge.chr_banks[slot] = cartridge.chr_rom + cartridge.banks.chr[slot];
+}
+
+/* Called after a snapshot is loaded, whose banks may differ from what the
+ * slots point at */
+void restore_banks()
+{
+  /* Without a cartridge the slots stay on the flat memory */
+  if (!cartridge.prg_rom)
+  {
+    return;
+  }
+
+  for (int slot = 0; slot < PRG_BANK_SLOTS; slot++)
+  {
+    map_prg_offset(slot - 1, cartridge.banks.prg[slot]);
+  }
+
+  for (int slot = 0; slot < 8; slot++)
+  {
+    cartridge.chr_banks[slot] = cartridge.chr_rom + cartridge.banks.chr[slot];
+  }
+}
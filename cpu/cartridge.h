@@ -0,0 +1,107 @@
+#ifndef C_CARTRIDGE_H
+#define C_CARTRIDGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PRG_BANK_SIZE 0x2000
+#define PRG_BANK_SLOTS 5
+#define CHR_BANK_SIZE 0x0400
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
+
+enum mirroring {mirroring_horizontal, mirroring_vertical, mirroring_four_screen};
+enum region {region_ntsc, region_pal, region_dendy};
+
+/* What the board has switched in, as offsets into the ROM so snapshots
+ * hold no pointers */
+struct bank_map
+{
+  /* PRG-ROM offset mapped at $6000 + slot * $2000, -1 where RAM is */
+  long prg[PRG_BANK_SLOTS];
+  /* CHR offset mapped at slot * $400 */
+  long chr[8];
+};
+
+/* Decompressed ROM file shared by every cartridge loaded from it */
+struct rom_image
+{
+  uint32_t crc;
+  size_t size;
+  int refs;
+  struct rom_image* next;
+  uint8_t data[];
+};
+
+struct cartridge
+{
+  uint8_t* prg_rom;
+  uint8_t* chr_rom;
+  size_t prg_size;
+  size_t chr_size;
+  int mapper;
+  int submapper;
+  int vertical_mirroring;
+  int four_screen;
+  size_t prg_ram_size;
+  size_t chr_ram_size;
+  enum region region;
+  uint32_t crc;
+  struct rom_image* image;
+  uint8_t* chr_banks[8];
+  /* Last, the only part a snapshot keeps */
+  struct bank_map banks;
+};
+
+/* Header correction, RAM sizes are in KB */
+struct game_entry
+{
+  uint32_t crc;
+  int16_t mapper;
+  uint8_t submapper;
+  uint8_t mirroring;
+  uint8_t prg_ram;
+  uint8_t chr_ram;
+  uint8_t region;
+  uint8_t valid;
+};
+
+extern struct cartridge cartridge;
+
+/* Mapper hooks, NULL when the board has no registers */
+extern void (*mapper_write)(uint16_t address, uint8_t data);
+/* Registers read with side effects, on pages the mapper sets to NULL */
+extern uint8_t (*mapper_read)(uint16_t address);
+extern void (*mapper_ppu_changed)(uint8_t ctrl, uint8_t mask);
+/* The board's IRQ counter event, for the scheduler to find it by */
+extern void (*mapper_irq)();
+
+/* Expansion audio level at the current cycle, for the APU to mix */
+extern int (*mapper_audio)();
+
+int load_rom(const uint8_t* data, size_t size);
+int load_image(struct rom_image* image);
+int load_zip(FILE* file);
+struct rom_image* read_zip(FILE* file);
+int rom_info(const uint8_t* data, size_t size, struct game_entry* info);
+uint32_t rom_crc32(uint32_t crc, const uint8_t* data, size_t size);
+const struct game_entry* gamedb_lookup(uint32_t crc);
+struct rom_image* rom_cache_acquire(uint32_t crc, size_t size);
+struct rom_image* rom_cache_insert(struct rom_image* image);
+void rom_cache_release(struct rom_image* image);
+void unload_rom();
+void map_prg(int slot, int bank);
+void map_prg_ram(int slot);
+void map_chr(int slot, int bank);
+void restore_banks();
+
+/* Boards */
+void mmc3_init();
+void mmc5_init();
+void vrc6_init(int swap);
+void vrc7_init();
+void fme7_init();
+void n163_init();
+
+#endif
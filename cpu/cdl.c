@@ -0,0 +1,64 @@
+#include "cdl.h"
+#include <stdlib.h>
+#include <string.h>
+
+uint8_t* cdl_prg;
+uint8_t* cdl_chr;
+size_t cdl_prg_size;
+size_t cdl_chr_size;
+uint16_t cdl_instruction;
+
+/* Clear the log and size it for the loaded ROM. Call after each load.
+ * CHR-RAM is not logged. */
+void cdl_reset()
+{
+  cdl_prg_size = cartridge.prg_size;
+  cdl_chr_size = cartridge.chr_size;
+  free(cdl_prg);
+  free(cdl_chr);
+  cdl_prg = calloc(cdl_prg_size ? cdl_prg_size : 1, 1);
+  cdl_chr = calloc(cdl_chr_size ? cdl_chr_size : 1, 1);
+}
+
+/* Merge a .cdl file of the loaded ROM into the current log. A file
+ * without CHR is accepted. */
+int cdl_load(FILE* file)
+{
+  uint8_t* data = malloc(cdl_prg_size + cdl_chr_size + 1);
+
+  if (!data || fread(data, 1, cdl_prg_size, file) != cdl_prg_size)
+  {
+    free(data);
+    return -1;
+  }
+
+  size_t chr_size = fread(data + cdl_prg_size, 1, cdl_chr_size, file);
+
+  for (size_t index = 0; index < cdl_prg_size; index++)
+  {
+    cdl_prg[index] |= data[index];
+  }
+
+  for (size_t index = 0; index < chr_size; index++)
+  {
+    cdl_chr[index] |= data[cdl_prg_size + index];
+  }
+
+  free(data);
+  return 0;
+}
+
+int cdl_save(FILE* file)
+{
+  if (fwrite(cdl_prg, 1, cdl_prg_size, file) != cdl_prg_size)
+  {
+    return -1;
+  }
+
+  if (fwrite(cdl_chr, 1, cdl_chr_size, file) != cdl_chr_size)
+  {
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef C_CDL_H
+#define C_CDL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cartridge.h"
+
+/* Code/data logger. Keeps one byte of flags per PRG-ROM and CHR-ROM byte
+ * using the FCEUX .cdl layout: PRG flags followed by CHR flags, each as
+ * long as the ROM. CPU and PPU addresses are logged at the ROM offset of
+ * the bank mapped there. Bit 7 of a PRG byte is unused by FCEUX, we use it
+ * to mark operand bytes. */
+
+/* PRG flags */
+#define CDL_CODE 0x01
+#define CDL_DATA 0x02
+#define CDL_INDIRECT_CODE 0x10
+#define CDL_INDIRECT_DATA 0x20
+#define CDL_OPERAND 0x80
+
+/* CHR flags */
+#define CDL_CHR_DRAWN 0x01
+#define CDL_CHR_READ 0x02
+
+extern uint8_t* cdl_prg;
+extern uint8_t* cdl_chr;
+extern size_t cdl_prg_size;
+extern size_t cdl_chr_size;
+extern uint16_t cdl_instruction;
+
+void cdl_reset();
+int cdl_load(FILE* file);
+int cdl_save(FILE* file);
+
+/* Logging is compiled in only with -DCDL, otherwise the hooks vanish */
+#ifdef CDL
+#define CDL_LOG_PRG(address, flag) ({ \
+  long bank = (address) >= 0x6000 ? cartridge.banks.prg[((address) - 0x6000) >> 13] : -1; \
+  if (bank >= 0 && (size_t) bank < cdl_prg_size) cdl_prg[bank + ((address) & 0x1FFF)] |= (flag); \
+})
+#define CDL_LOG_CHR(address, flag) ({ \
+  size_t offset = cartridge.banks.chr[((address) >> 10) & 7] + ((address) & 0x3FF); \
+  if (offset < cdl_chr_size) cdl_chr[offset] |= (flag); \
+})
+/* A read at pc is the next opcode being fetched, reads within two bytes of
+ * the current opcode are operand fetches */
+#define CDL_LOG_READ(address) ({ \
+  if ((address) == pc) cdl_instruction = (address); \
+  uint16_t offset = (address) - cdl_instruction; \
+  CDL_LOG_PRG(address, offset == 0 ? CDL_CODE : \
+    offset < 3 ? CDL_CODE | CDL_OPERAND : CDL_DATA); \
+})
+#define CDL_LOG_OPCODE(address) ({ \
+  cdl_instruction = (address); \
+  CDL_LOG_PRG(address, CDL_CODE); \
+})
+#else
+#define CDL_LOG_PRG(address, flag)
+#define CDL_LOG_CHR(address, flag)
+#define CDL_LOG_READ(address)
+#define CDL_LOG_OPCODE(address)
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+#include "cheat.h"
+#include "cpu.h"
+#include <string.h>
+
+static struct
+{
+  struct cheat list[CHEAT_MAX];
+  int count;
+  struct cheat_page pages[CHEAT_MAX];
+} cheats;
+
+/* The codes are the player's, not the game's, so snapshots leave them out.
+ * Loading one maps the banks again, which patches them with cheat_map. */
+const struct state_chunk cheat_state[] = {
+  {&cheats, sizeof(cheats), STATE_CONTEXT},
+  STATE_END
+};
+
+/* Game Genie letters, in the order of the nibbles they stand for */
+static const char letters[] = "APZLGITYEOXUKSVN";
+
+void cheat_reset()
+{
+  memset(&cheats, 0, sizeof(cheats));
+
+  for (int index = 0; index < CHEAT_MAX; index++)
+  {
+    cheats.pages[index].page = -1;
+  }
+}
+
+/* Patched copy of a page, made from what the page shows now */
+static struct cheat_page* patched_page(int page)
+{
+  struct cheat_page* free_page = NULL;
+
+  for (int index = 0; index < CHEAT_MAX; index++)
+  {
+    if (cheats.pages[index].page == page)
+    {
+      return &cheats.pages[index];
+    }
+    if (cheats.pages[index].page < 0 && !free_page)
+    {
+      free_page = &cheats.pages[index];
+    }
+  }
+
+  free_page->page = page;
+  free_page->source = *HOOK_SLOT(page);
+  memcpy(free_page->data, free_page->source, sizeof(free_page->data));
+  *HOOK_SLOT(page) = free_page->data;
+  return free_page;
+}
+
+/* Called once pages have been pointed at new ROM, to patch them again. A
+ * page gets a copy while it has a ROM code. */
+void cheat_map(int first_page, int pages)
+{
+  for (int index = 0; index < CHEAT_MAX; index++)
+  {
+    struct cheat_page* patched = &cheats.pages[index];
+    if (patched->page >= first_page && patched->page < first_page + pages)
+    {
+      if (*HOOK_SLOT(patched->page) == patched->data)
+      {
+        *HOOK_SLOT(patched->page) = patched->source;
+      }
+      patched->page = -1;
+    }
+  }
+
+  for (int index = 0; index < cheats.count; index++)
+  {
+    const struct cheat* cheat = &cheats.list[index];
+    int page = cheat->address >> 8;
+
+    if (cheat->kind != cheat_rom || page < first_page || page >= first_page + pages)
+    {
+      continue;
+    }
+
+    struct cheat_page* patched = patched_page(page);
+    if (cheat->compare == CHEAT_NO_COMPARE || patched->source[cheat->address & 0xFF] == cheat->compare)
+    {
+      patched->data[cheat->address & 0xFF] = cheat->value;
+    }
+  }
+}
+
+/* Undo every patch and drop the codes */
+void cheat_clear()
+{
+  for (int index = 0; index < CHEAT_MAX; index++)
+  {
+    if (cheats.pages[index].page >= 0)
+    {
+      *HOOK_SLOT(cheats.pages[index].page) = cheats.pages[index].source;
+    }
+  }
+
+  cheat_reset();
+}
+
+/* ROM codes take effect at once, freezes from the end of this frame. -1
+ * when the list is full or a ROM code points below $8000. */
+int cheat_add(struct cheat cheat)
+{
+  if (cheats.count == CHEAT_MAX || (cheat.kind == cheat_rom && cheat.address < PRG_ROM))
+  {
+    return -1;
+  }
+
+  cheats.list[cheats.count++] = cheat;
+  if (cheat.kind == cheat_rom)
+  {
+    cheat_map(cheat.address >> 8, 1);
+  }
+
+  return 0;
+}
+
+/* Decode a 6 or 8 letter Game Genie code. 8 letter codes only patch over
+ * the compare value, which is how they pick one bank of a banked game. */
+int cheat_game_genie(const char* code, struct cheat* cheat)
+{
+  size_t length = strlen(code);
+  int n[8];
+
+  if (length != 6 && length != 8)
+  {
+    return -1;
+  }
+
+  for (size_t index = 0; index < length; index++)
+  {
+    const char* letter = strchr(letters, toupper(code[index]));
+    if (!letter || !*letter)
+    {
+      return -1;
+    }
+    n[index] = letter - letters;
+  }
+
+  cheat->kind = cheat_rom;
+  cheat->address = PRG_ROM | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8) |
+    ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8);
+  cheat->value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7);
+
+  if (length == 6)
+  {
+    cheat->value |= n[5] & 8;
+    cheat->compare = CHEAT_NO_COMPARE;
+  }
+  else
+  {
+    cheat->value |= n[7] & 8;
+    cheat->compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+  }
+
+  return 0;
+}
+
+/* Decode a Pro Action Replay code, four hex digits of RAM address and two
+ * of the value to freeze it at */
+int cheat_action_replay(const char* code, struct cheat* cheat)
+{
+  unsigned value = 0;
+
+  if (strlen(code) != 6)
+  {
+    return -1;
+  }
+
+  for (int index = 0; index < 6; index++)
+  {
+    if (!isxdigit(code[index]))
+    {
+      return -1;
+    }
+    value = (value << 4) | (isdigit(code[index]) ? code[index] - '0' : toupper(code[index]) - 'A' + 10);
+  }
+
+  cheat->kind = cheat_freeze;
+  cheat->address = value >> 8;
+  cheat->value = value & 0xFF;
+  cheat->compare = CHEAT_NO_COMPARE;
+  return 0;
+}
+
+/* Called by run_frame as each frame ends */
+void cheat_end_frame()
+{
+  for (int index = 0; index < cheats.count; index++)
+  {
+    if (cheats.list[index].kind == cheat_freeze)
+    {
+      memory[cheats.list[index].address] = cheats.list[index].value;
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef C_CHEAT_H
+#define C_CHEAT_H
+
+#include <stdint.h>
+
+/* Game Genie and Pro Action Replay codes. ROM codes put the page they
+ * patch on a patched copy through read_pages, so reads of every other page
+ * stay on the direct path. RAM codes are freezes applied as each frame
+ * ends. Both are kept per instance. */
+#define CHEAT_MAX 16
+#define CHEAT_NO_COMPARE -1
+
+enum cheat_kind {cheat_rom, cheat_freeze};
+
+struct cheat
+{
+  uint16_t address;
+  uint8_t value;
+  uint8_t kind;
+  /* ROM byte the patch applies over, CHEAT_NO_COMPARE for any */
+  int16_t compare;
+};
+
+/* A page of ROM with cheats applied */
+struct cheat_page
+{
+  int page;
+  uint8_t* source;
+  uint8_t data[256];
+};
+
+void cheat_reset();
+int cheat_add(struct cheat cheat);
+int cheat_game_genie(const char* code, struct cheat* cheat);
+int cheat_action_replay(const char* code, struct cheat* cheat);
+void cheat_clear();
+void cheat_map(int first_page, int pages);
+void cheat_end_frame();
+
+#endif
@@ -1,30 +1,132 @@
 #include "cpu.h"
 #include "opcodes.h"
 
+uint8_t* memory;
+uint16_t sp;
+uint16_t pc;
+
+uint8_t accumulator;
+uint8_t index_x;
+uint8_t index_y;
+uint8_t processor_status;
+
+long long cycles;
+int irq_line;
+int jammed;
+long long nmi_count;
+
+uint8_t* read_pages[256];
+
+const struct state_chunk cpu_state[] = {
+  {&memory, sizeof(memory), STATE_CONTEXT},
+  {&memory, STATE_MEMORY_SIZE, STATE_SNAPSHOT | STATE_INDIRECT},
+  {&sp, sizeof(sp), STATE_ALL},
+  {&pc, sizeof(pc), STATE_ALL},
+  {&accumulator, sizeof(accumulator), STATE_ALL},
+  {&index_x, sizeof(index_x), STATE_ALL},
+  {&index_y, sizeof(index_y), STATE_ALL},
+  {&processor_status, sizeof(processor_status), STATE_ALL},
+  {&cycles, sizeof(cycles), STATE_ALL},
+  {&irq_line, sizeof(irq_line), STATE_ALL},
+  {&jammed, sizeof(jammed), STATE_ALL},
+  {&nmi_count, sizeof(nmi_count), STATE_ALL},
+  {read_pages, sizeof(read_pages), STATE_CONTEXT},
+  STATE_END
+};
+
 int initialize_cpu()
 {
   memory = calloc(65535, 8);
+
+  for (int page = 0; page < 256; page++)
+  {
+    read_pages[page] = memory + (page << 8);
+  }
+  read_pages[INPUT_PAGE] = NULL;
+
   sp = 0x0100;
   accumulator = 0;
   pc = 0;
   processor_status = 0x20;
+  cycles = 0;
+  irq_line = 0;
+  jammed = 0;
+  nmi_count = 0;
+  timing_reset();
+  scheduler_reset();
+  dma_reset();
+  ppu_reset();
+  input_reset();
+  cheat_reset();
+  HOOK_RESET();
   return 0;
 }
 
 int deinitialize_cpu()
 {
+  unload_rom();
   free(memory);
   return 0;
 }
 
 uint8_t read8(uint16_t address)
 {
-  return memory[address];
+  CDL_LOG_READ(address);
+  HEATMAP_LOG(address, heatmap_read);
+  uint8_t* page = read_pages[address >> 8];
+  return page ? page[address & 0xFF] : read_slow(address);
+}
+
+/* Pages without a pointer have registers with side effects on read, or
+ * read hooks */
+uint8_t read_slow(uint16_t address)
+{
+  uint8_t* page = HOOKED_PAGE(address);
+  uint8_t value;
+
+  if (page)
+  {
+    value = page[address & 0xFF];
+  }
+  else if (address == INPUT_PORT1 || address == INPUT_PORT2)
+  {
+    value = input_read(address - INPUT_PORT1);
+  }
+  else if (mapper_read && address >= 0x4020)
+  {
+    value = mapper_read(address);
+  }
+  else
+  {
+    value = memory[address];
+  }
+
+  HOOK_READ(address, value);
+  return value;
 }
 
 void write(uint16_t address, uint8_t data)
 {
+  HEATMAP_LOG(address, heatmap_write);
   memory[address] = data;
+  HOOK_WRITE(address, data);
+
+  if ((address & 0xE000) == IO_REGISTERS)
+  {
+    ppu_write(address, data);
+  }
+  else if (address == INPUT_STROBE)
+  {
+    input_write(data);
+  }
+  else if ((address & 0xFFE0) == APU_IO_REGISTERS)
+  {
+    dma_write(address, data);
+  }
+  else if (mapper_write && (address >= PRG_ROM || (address >= 0x4020 && address < 0x6000)))
+  {
+    mapper_write(address, data);
+  }
 }
 
 void print_value(uint16_t address)
@@ -81,85 +183,54 @@ void setflag(enum program_flag flag, uint8_t value)
   processor_status ^= (-newbit ^ processor_status) & (0x01 << flag);
 }
 
-void perform_instruction(uint8_t opcode, uint16_t address)
+void irq()
+{
+  if (jammed)
+  {
+    return;
+  }
+
+  TRACE_BEGIN(trace_interrupt);
+  push_stack16(pc);
+  push_stack8(processor_status & ~0x10);
+  setflag(i, 1);
+  pc = ADDR_16(IRQ_VECTOR);
+  cycles += 7;
+  TRACE_END(trace_interrupt);
+}
+
+void nmi()
 {
-  switch (opcode) {
-    case 0x00:
-      BRK();
-      // size = 2;
-      cycles += 7;
-      break;
-    case 0x01:
-      ORA(INDEXED_INDIRECT_X(address));
-      // size = 2;
-      cycles += 6;
-      break;
-    case 0x03:
-      SLO(INDEXED_INDIRECT_X(address));
-      // size = 2;
-      cycles += 8;
-      break;
-    case 0x04:
-      NOP(ZERO_PAGE(address));
-      // size = 1;
-      cycles += 1;
-      break;
-    case 0x05:
-      ORA(ZERO_PAGE(address));
-      // size = 2;
-      cycles += 3;
-      break;
-    case 0x06:
-      ASL(ZERO_PAGE(address), address, 1);
-      // size = 2;
-      cycles += 5;
-      break;
-    case 0x07:
-      SLO(ZERO_PAGE(address));
-      // size = 2;
-      cycles += 5;
-      break;
-    case 0x08:
-      PHP();
-      // size = 1;
-      cycles += 3;
-      break;
-    case 0x09:
-      ORA(IMMEDIATE(address));
-      // size = 2;
-      cycles += 2;
-      break;
-    case 0x0A:
-      // ASL with implied addressing; what to do here?
-      // size = 1;
-      cycles += 2;
-      break;
-    case 0x0B:
-      ANC(IMMEDIATE(address));
-      // size = 2;
-      cycles += 2;
-      break;
-    case 0x0C:
-      NOP(ABSOLUTE(address));
-      // size = 1;
-      cycles += 2;
-      break;
-    case 0x0D:
-      ORA(ABSOLUTE(address));
-      // size = 3;
-      cycles += 4;
-      break;
-    case 0x0E:
-      ASL(ABSOLUTE(address), address, 1);
-      // size = 3;
-      cycles += 6;
-      break;
-    case 0x0F:
-      SLO(ABSOLUTE(address));
-      // size = 3;
-      cycles += 6;
-      break;
-    default:
-      break;
+  if (jammed)
+  {
+    return;
   }
+
+  TRACE_BEGIN(trace_interrupt);
+  push_stack16(pc);
+  push_stack8(processor_status & ~0x10);
+  setflag(i, 1);
+  pc = ADDR_16(NMI_VECTOR);
+  cycles += 7;
+  nmi_count++;
+  TRACE_END(trace_interrupt);
+}
+
+/* The IRQ line is level triggered, while it is held the scheduler checks
+ * it after every instruction */
+void set_irq(int level)
+{
+  irq_line = level;
+  update_next_event();
+}
+
+void perform_instruction(uint8_t opcode, uint16_t address)
+{
+  CDL_LOG_OPCODE(address);
+  HEATMAP_LOG(address, heatmap_execute);
+
+  opcode_table[opcode](address);
+  RUN_EVENTS();
+
+  METRICS_ADD(metric_instructions, 1);
 }
@@ -5,34 +5,60 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include "cdl.h"
+#include "heatmap.h"
+#include "trace.h"
+#include "metrics.h"
+#include "tables.h"
+#include "scheduler.h"
+#include "dma.h"
+#include "ppu.h"
+#include "cartridge.h"
+#include "region.h"
+#include "input.h"
+#include "state.h"
+#include "cheat.h"
+#include "hook.h"
 
 #define STACK 0x100
 #define IO_REGISTERS 0x2000
+#define APU_IO_REGISTERS 0x4000
 #define PRG_ROM 0x8000
 #define NMI_VECTOR 0xFFFA
 #define RESET_VECTOR 0xFFFC
 #define IRQ_VECTOR 0xFFFE
 
-uint8_t* memory;
-uint16_t sp;
-uint16_t pc;
+extern uint8_t* memory;
+extern uint16_t sp;
+extern uint16_t pc;
 
-uint8_t accumulator;
-uint8_t index_x;
-uint8_t index_y;
-uint8_t processor_status;
+extern uint8_t accumulator;
+extern uint8_t index_x;
+extern uint8_t index_y;
+extern uint8_t processor_status;
 
-int cycles;
+extern long long cycles;
+extern int irq_line;
+extern int jammed;
+extern long long nmi_count;
+
+/* CPU reads go through 256-byte pages so mappers can bank switch by
+ * repointing pages. A NULL page sends reads to read_slow. */
+extern uint8_t* read_pages[256];
 
 enum program_flag {c, z, i, d, b, e, v, n};
 
 /* CPU functions */
 uint8_t read8(uint16_t address);
+uint8_t read_slow(uint16_t address);
 void write(uint16_t address, uint8_t data);
 int initialize_cpu();
 int deinitialize_cpu();
 void print_value(uint16_t address);
 void perform_instruction(uint8_t opcode, uint16_t address);
+void irq();
+void nmi();
+void set_irq(int level);
 
 /* Stack functions */
 void push_stack8(uint8_t value);
@@ -45,6 +71,11 @@ uint8_t highbit(uint8_t value);
 uint8_t getflag(enum program_flag flag);
 void setflag(enum program_flag flag, uint8_t value);
 
+/* Set N and Z from a result in one table lookup */
+#define SET_NZ(value) ({ \
+  processor_status = (processor_status & 0x7D) | nz_flags[(uint8_t) (value)]; \
+})
+
 /* Addressing modes */
 #define READ(address) ({ read8(address); })
 #define ADDR_16(address) ({ \
@@ -67,6 +98,7 @@ void setflag(enum program_flag flag, uint8_t value);
 #define INDIRECT(address) ({ pc += 3; \
   uint16_t addr = ADDR_16(address + 1); \
   uint16_t addr2 = ADDR_16(addr); \
+  CDL_LOG_PRG(addr2, CDL_INDIRECT_DATA); \
   READ(addr2);\
 })
 /* TODO: Figure out how to use this addressing mode */
@@ -80,11 +112,13 @@ void setflag(enum program_flag flag, uint8_t value);
 #define INDEXED_INDIRECT_X(address) ({ pc += 2; \
   uint16_t addr = ADDR_16(READ(address) + index_x); \
   uint16_t addr2 = ADDR_16(addr); \
+  CDL_LOG_PRG(addr2, CDL_INDIRECT_DATA); \
   READ(addr2);\
 })
 #define INDEXED_INDIRECT_Y(address) ({ pc += 2; \
   uint16_t addr = ADDR_16(READ(address) + index_y); \
   uint16_t addr2 = ADDR_16(addr); \
+  CDL_LOG_PRG(addr2, CDL_INDIRECT_DATA); \
   READ(addr2);\
 })
 #define IMMEDIATE(address) ({ address; })
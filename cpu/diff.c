@@ -0,0 +1,119 @@
+#include "diff.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Bit n set when byte n of the 16 at before and after differs */
+static unsigned changed_mask(const uint8_t* before, const uint8_t* after)
+{
+#ifdef __SSE2__
+  __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) before),
+      _mm_loadu_si128((const __m128i*) after));
+  return ~_mm_movemask_epi8(equal) & 0xFFFF;
+#else
+  unsigned mask = 0;
+  for (int index = 0; index < 16; index++)
+  {
+    mask |= (unsigned) (before[index] != after[index]) << index;
+  }
+  return mask;
+#endif
+}
+
+/* List the bytes that differ between two buffers, at most max_changes of
+ * them. Returns how many differ in all, which can be more. */
+size_t state_diff(const uint8_t* before, const uint8_t* after, size_t size,
+    struct state_change* changes, size_t max_changes)
+{
+  size_t found = 0;
+  size_t offset = 0;
+
+  for (; offset + 16 <= size; offset += 16)
+  {
+    unsigned mask = changed_mask(before + offset, after + offset);
+
+    while (mask)
+    {
+      size_t at = offset + __builtin_ctz(mask);
+      if (found < max_changes)
+      {
+        changes[found] = (struct state_change) {at, before[at], after[at]};
+      }
+      found++;
+      mask &= mask - 1;
+    }
+  }
+
+  for (; offset < size; offset++)
+  {
+    if (before[offset] != after[offset])
+    {
+      if (found < max_changes)
+      {
+        changes[found] = (struct state_change) {offset, before[offset], after[offset]};
+      }
+      found++;
+    }
+  }
+
+  return found;
+}
+
+/* For each of the first size bytes of count frames stride apart, count the
+ * frames where whether the byte changed since the previous frame matches
+ * signal[frame]. A byte that moves exactly with the signal scores count - 1,
+ * agree[] takes size counts. */
+void diff_lockstep(const uint8_t* frames, size_t stride, int count, size_t size,
+    const uint8_t* signal, uint32_t* agree)
+{
+  memset(agree, 0, size * sizeof(uint32_t));
+
+  for (size_t offset = 0; offset < size; offset += 16)
+  {
+    size_t width = size - offset < 16 ? size - offset : 16;
+    int frame = 1;
+
+    while (frame < count)
+    {
+      /* Byte counters, emptied before they can wrap */
+      uint8_t counts[16] = {0};
+      int last = frame + 255 < count ? frame + 255 : count;
+
+#ifdef __SSE2__
+      if (width == 16)
+      {
+        __m128i sums = _mm_setzero_si128();
+
+        for (; frame < last; frame++)
+        {
+          const uint8_t* previous = frames + (frame - 1) * stride + offset;
+          const uint8_t* current = previous + stride;
+          __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) previous),
+              _mm_loadu_si128((const __m128i*) current));
+          __m128i quiet = _mm_set1_epi8(signal[frame] ? 0 : -1);
+          sums = _mm_sub_epi8(sums, _mm_cmpeq_epi8(same, quiet));
+        }
+
+        _mm_storeu_si128((__m128i*) counts, sums);
+      }
+#endif
+
+      for (; frame < last; frame++)
+      {
+        const uint8_t* previous = frames + (frame - 1) * stride + offset;
+        const uint8_t* current = previous + stride;
+
+        for (size_t index = 0; index < width; index++)
+        {
+          counts[index] += (previous[index] != current[index]) == !!signal[frame];
+        }
+      }
+
+      for (size_t index = 0; index < width; index++)
+      {
+        agree[offset + index] += counts[index];
+      }
+    }
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef C_DIFF_H
+#define C_DIFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Byte diffs of snapshots, or of any two buffers with the same layout, for
+ * RAM watch, RAM search and desync hunting. state_offset finds RAM or OAM
+ * within a snapshot. */
+#define DIFF_RAM_SIZE 0x800
+
+struct state_change
+{
+  uint32_t offset;
+  uint8_t before;
+  uint8_t after;
+};
+
+size_t state_diff(const uint8_t* before, const uint8_t* after, size_t size,
+    struct state_change* changes, size_t max_changes);
+void diff_lockstep(const uint8_t* frames, size_t stride, int count, size_t size,
+    const uint8_t* signal, uint32_t* agree);
+
+#endif
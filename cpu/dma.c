@@ -0,0 +1,108 @@
+#include "dma.h"
+#include "cpu.h"
+#include "scheduler.h"
+#include <string.h>
+
+uint8_t oam[OAM_SIZE];
+struct dmc dmc;
+
+static uint8_t oam_page;
+
+const struct state_chunk dma_state[] = {
+  {oam, sizeof(oam), STATE_ALL},
+  {&dmc, sizeof(dmc), STATE_ALL},
+  {&oam_page, sizeof(oam_page), STATE_ALL},
+  STATE_END
+};
+
+void dma_reset()
+{
+  memset(oam, 0, OAM_SIZE);
+  memset(&dmc, 0, sizeof(dmc));
+  dmc.period = timing->dmc_rates[0];
+  dmc.start_address = 0xC000;
+  dmc.start_length = 1;
+}
+
+void dma_write(uint16_t address, uint8_t data)
+{
+  switch (address) {
+    case 0x4010:
+      dmc.period = timing->dmc_rates[data & 0x0F];
+      dmc.loop = (data & 0x40) != 0;
+      break;
+    case 0x4012:
+      dmc.start_address = 0xC000 + (data << 6);
+      break;
+    case 0x4013:
+      dmc.start_length = (data << 4) + 1;
+      break;
+    case OAM_DMA:
+      /* The copy starts once the writing instruction has finished */
+      oam_page = data;
+      schedule_event(cycles, oam_dma);
+      break;
+    case 0x4015:
+      if (!(data & 0x10))
+      {
+        dmc.remaining = 0;
+        cancel_event(dmc_fetch);
+      }
+      else if (!dmc.remaining)
+      {
+        dmc.address = dmc.start_address;
+        dmc.remaining = dmc.start_length;
+        schedule_event(clock_cycle(system_clock(cycles) + dmc.period * 8), dmc_fetch);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/* Copies a page into OAM and stalls the CPU for 513 cycles, plus one when
+ * the DMA starts on an odd cycle */
+void oam_dma()
+{
+  uint16_t source = oam_page << 8;
+
+  TRACE_BEGIN(trace_dma);
+
+  if (read_pages[oam_page] && (source < IO_REGISTERS || source >= 0x4000))
+  {
+    memcpy(oam, read_pages[oam_page], OAM_SIZE);
+  }
+  else
+  {
+    for (int index = 0; index < OAM_SIZE; index++)
+    {
+      oam[index] = READ(source + index);
+    }
+  }
+
+  cycles += 513 + (cycles & 1);
+  TRACE_END(trace_dma);
+}
+
+/* Reads the next sample byte, stealing 4 cycles, and schedules the fetch
+ * for when the output unit has shifted out all 8 bits */
+void dmc_fetch()
+{
+  TRACE_BEGIN(trace_dma);
+  dmc.sample = READ(dmc.address);
+  dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+  cycles += 4;
+
+  if (!--dmc.remaining && dmc.loop)
+  {
+    dmc.address = dmc.start_address;
+    dmc.remaining = dmc.start_length;
+  }
+
+  if (dmc.remaining)
+  {
+    schedule_event(clock_cycle(system_clock(cycles) + dmc.period * 8), dmc_fetch);
+  }
+
+  TRACE_END(trace_dma);
+}
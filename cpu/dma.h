@@ -0,0 +1,30 @@
+#ifndef C_DMA_H
+#define C_DMA_H
+
+#include <stdint.h>
+
+#define OAM_DMA 0x4014
+#define OAM_SIZE 256
+
+extern uint8_t oam[OAM_SIZE];
+
+/* DMC sample playback state, only the memory side is modelled */
+struct dmc
+{
+  uint16_t address;
+  uint16_t remaining;
+  uint16_t start_address;
+  uint16_t start_length;
+  int period;
+  int loop;
+  uint8_t sample;
+};
+
+extern struct dmc dmc;
+
+void dma_reset();
+void dma_write(uint16_t address, uint8_t data);
+void oam_dma();
+void dmc_fetch();
+
+#endif
@@ -0,0 +1,37 @@
+#include "heatmap.h"
+#include <string.h>
+
+uint32_t heatmap[HEATMAP_PAGES][3];
+
+void heatmap_reset()
+{
+  memset(heatmap, 0, sizeof(heatmap));
+}
+
+/* Append this frame's counters to file and start counting the next frame */
+int heatmap_end_frame(FILE* file)
+{
+  uint8_t buffer[HEATMAP_PAGES * 3 * 4];
+  uint8_t* out = buffer;
+
+  for (int page = 0; page < HEATMAP_PAGES; page++)
+  {
+    for (int access = 0; access < 3; access++)
+    {
+      uint32_t count = heatmap[page][access];
+      *out++ = count & 0xFF;
+      *out++ = (count >> 8) & 0xFF;
+      *out++ = (count >> 16) & 0xFF;
+      *out++ = count >> 24;
+    }
+  }
+
+  heatmap_reset();
+
+  if (fwrite(buffer, 1, sizeof(buffer), file) != sizeof(buffer))
+  {
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef C_HEATMAP_H
+#define C_HEATMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Per 256-byte page access counters, exported once per frame as a flat
+ * array of HEATMAP_PAGES * 3 little-endian uint32 (read, write, execute). */
+#define HEATMAP_PAGES 256
+
+enum heatmap_access {heatmap_read, heatmap_write, heatmap_execute};
+
+extern uint32_t heatmap[HEATMAP_PAGES][3];
+
+void heatmap_reset();
+int heatmap_end_frame(FILE* file);
+
+#ifdef HEATMAP
+#define HEATMAP_LOG(address, access) ({ heatmap[(address) >> 8][access]++; })
+#else
+#define HEATMAP_LOG(address, access)
+#endif
+
+#endif
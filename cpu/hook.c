@@ -0,0 +1,211 @@
+#include "hook.h"
+#include "cpu.h"
+#include <string.h>
+
+uint8_t* hook_pages[256];
+uint32_t hook_read_pages[8];
+uint32_t hook_write_pages[8];
+
+static struct
+{
+  struct hook list[HOOK_MAX];
+  uint8_t used[HOOK_MAX];
+} hooks;
+
+/* Accesses for batch hooks, empty between frames */
+static struct
+{
+  struct hook_event events[HOOK_QUEUE];
+  uint8_t hooks[HOOK_QUEUE];
+  int count;
+} queue;
+
+/* Hooks point into their owner's code and data, so snapshots leave them
+ * out. Loading one maps the banks again, which takes the hooked pages back
+ * out of read_pages with hook_map. */
+const struct state_chunk hook_state[] = {
+  {hook_pages, sizeof(hook_pages), STATE_CONTEXT},
+  {hook_read_pages, sizeof(hook_read_pages), STATE_CONTEXT},
+  {hook_write_pages, sizeof(hook_write_pages), STATE_CONTEXT},
+  {&hooks, sizeof(hooks), STATE_CONTEXT},
+  {&queue, sizeof(queue), STATE_CONTEXT},
+  STATE_END
+};
+
+void hook_reset()
+{
+  memset(hook_pages, 0, sizeof(hook_pages));
+  memset(hook_read_pages, 0, sizeof(hook_read_pages));
+  memset(hook_write_pages, 0, sizeof(hook_write_pages));
+  memset(&hooks, 0, sizeof(hooks));
+  queue.count = 0;
+}
+
+/* Where a page's real pointer lives, for code that repoints pages */
+uint8_t** hook_page(int page)
+{
+  return HOOK_PAGE(hook_read_pages, page << 8) ? &hook_pages[page] : &read_pages[page];
+}
+
+/* Called once pages have been pointed somewhere new, to take the hooked
+ * ones out of read_pages again */
+void hook_map(int first_page, int pages)
+{
+  for (int page = first_page; page < first_page + pages; page++)
+  {
+    if (HOOK_PAGE(hook_read_pages, page << 8) && read_pages[page])
+    {
+      hook_pages[page] = read_pages[page];
+      read_pages[page] = NULL;
+    }
+  }
+}
+
+/* Rebuild the bitmaps from the hooks, moving pages in or out of read_pages
+ * as they gain or lose read hooks */
+static void update_pages()
+{
+  uint32_t reads[8] = {0};
+
+  memset(hook_write_pages, 0, sizeof(hook_write_pages));
+  for (int id = 0; id < HOOK_MAX; id++)
+  {
+    if (!hooks.used[id])
+    {
+      continue;
+    }
+
+    for (int page = hooks.list[id].first >> 8; page <= hooks.list[id].last >> 8; page++)
+    {
+      uint32_t bit = 1u << (page & 0x1F);
+      reads[page >> 5] |= (hooks.list[id].kind & hook_read) ? bit : 0;
+      hook_write_pages[page >> 5] |= (hooks.list[id].kind & hook_write) ? bit : 0;
+    }
+  }
+
+  for (int page = 0; page < 256; page++)
+  {
+    int was = HOOK_PAGE(hook_read_pages, page << 8) != 0;
+    int now = (reads[page >> 5] >> (page & 0x1F)) & 1;
+
+    if (was && !now)
+    {
+      read_pages[page] = hook_pages[page];
+      hook_pages[page] = NULL;
+    }
+    else if (now && !was)
+    {
+      hook_pages[page] = read_pages[page];
+      read_pages[page] = NULL;
+    }
+  }
+
+  memcpy(hook_read_pages, reads, sizeof(reads));
+}
+
+/* Returns the hook's id, -1 when all are taken or the hook has neither
+ * callback */
+int hook_add(struct hook hook)
+{
+  if (!hook.callback && !hook.batch)
+  {
+    return -1;
+  }
+
+  for (int id = 0; id < HOOK_MAX; id++)
+  {
+    if (!hooks.used[id])
+    {
+      hooks.list[id] = hook;
+      hooks.used[id] = 1;
+      update_pages();
+      return id;
+    }
+  }
+
+  return -1;
+}
+
+/* Accesses the hook has waiting are dropped with it, so its batch is never
+ * called once removed and a hook given its id later does not get them */
+void hook_remove(int id)
+{
+  int kept = 0;
+
+  if (id < 0 || id >= HOOK_MAX || !hooks.used[id])
+  {
+    return;
+  }
+
+  for (int index = 0; index < queue.count; index++)
+  {
+    if (queue.hooks[index] != id)
+    {
+      queue.events[kept] = queue.events[index];
+      queue.hooks[kept++] = queue.hooks[index];
+    }
+  }
+  queue.count = kept;
+
+  hooks.used[id] = 0;
+  update_pages();
+}
+
+/* An access to a hooked page. Deferred accesses past HOOK_QUEUE in a frame
+ * are dropped. */
+void hook_notify(uint16_t address, uint8_t value, int kind)
+{
+  struct hook_event event = {address, value, kind};
+
+  for (int id = 0; id < HOOK_MAX; id++)
+  {
+    const struct hook* hook = &hooks.list[id];
+
+    if (!hooks.used[id] || !(hook->kind & kind) || address < hook->first || address > hook->last)
+    {
+      continue;
+    }
+
+    if (hook->callback)
+    {
+      hook->callback(event, hook->user);
+    }
+    else if (queue.count < HOOK_QUEUE)
+    {
+      queue.events[queue.count] = event;
+      queue.hooks[queue.count++] = id;
+    }
+  }
+}
+
+/* Called by run_frame as each frame ends. Each batch hook gets its own
+ * accesses in one call. */
+void hook_end_frame()
+{
+  struct hook_event events[HOOK_QUEUE];
+
+  if (!queue.count)
+  {
+    return;
+  }
+
+  for (int id = 0; id < HOOK_MAX; id++)
+  {
+    int count = 0;
+
+    for (int index = 0; index < queue.count; index++)
+    {
+      if (queue.hooks[index] == id)
+      {
+        events[count++] = queue.events[index];
+      }
+    }
+
+    if (count && hooks.used[id])
+    {
+      hooks.list[id].batch(events, count, hooks.list[id].user);
+    }
+  }
+
+  queue.count = 0;
+}
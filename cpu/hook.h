@@ -0,0 +1,72 @@
+#ifndef C_HOOK_H
+#define C_HOOK_H
+
+#include <stdint.h>
+
+/* Callbacks on reads and writes of address ranges, for RAM watchers and
+ * achievement checkers. A read-hooked page is taken out of read_pages, its
+ * pointer kept in hook_pages, so its reads go through read_slow while every
+ * other page stays a single pointer load. Writes test a page bitmap. */
+#define HOOK_MAX 32
+#define HOOK_QUEUE 1024
+
+#define HOOK_PAGE(bitmap, address) ((bitmap)[(address) >> 13] & (1u << (((address) >> 8) & 0x1F)))
+
+enum hook_kind {hook_read = 1, hook_write = 2, hook_access = 3};
+
+struct hook_event
+{
+  uint16_t address;
+  uint8_t value;
+  uint8_t kind;
+};
+
+/* Either callback, called at each access, or batch, called once as each
+ * frame ends with that frame's accesses in order */
+struct hook
+{
+  uint16_t first;
+  uint16_t last;
+  uint8_t kind;
+  void (*callback)(struct hook_event event, void* user);
+  void (*batch)(const struct hook_event* events, int count, void* user);
+  void* user;
+};
+
+extern uint8_t* hook_pages[256];
+extern uint32_t hook_read_pages[8];
+extern uint32_t hook_write_pages[8];
+
+void hook_reset();
+int hook_add(struct hook hook);
+void hook_remove(int id);
+uint8_t** hook_page(int page);
+void hook_map(int first_page, int pages);
+void hook_notify(uint16_t address, uint8_t value, int kind);
+void hook_end_frame();
+
+/* Hooks are compiled in only with -DHOOKS. Without them nothing is tested
+ * on access and pages are repointed straight in read_pages. */
+#ifdef HOOKS
+#define HOOK_READ(address, value) ({ \
+  if (HOOK_PAGE(hook_read_pages, address)) hook_notify(address, value, hook_read); \
+})
+#define HOOK_WRITE(address, value) ({ \
+  if (HOOK_PAGE(hook_write_pages, address)) hook_notify(address, value, hook_write); \
+})
+#define HOOKED_PAGE(address) hook_pages[(address) >> 8]
+#define HOOK_SLOT(page) hook_page(page)
+#define HOOK_MAP(first_page, pages) hook_map(first_page, pages)
+#define HOOK_RESET() hook_reset()
+#define HOOK_END_FRAME() hook_end_frame()
+#else
+#define HOOK_READ(address, value)
+#define HOOK_WRITE(address, value)
+#define HOOKED_PAGE(address) NULL
+#define HOOK_SLOT(page) (&read_pages[page])
+#define HOOK_MAP(first_page, pages)
+#define HOOK_RESET()
+#define HOOK_END_FRAME()
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#include "input.h"
+#include "cpu.h"
+#include <string.h>
+
+uint8_t input_buttons[2];
+struct input_frame input_current;
+struct input_frame input_last;
+long long lag_frames;
+
+static uint8_t strobe;
+static uint8_t shift[2];
+
+const struct state_chunk input_state[] = {
+  {input_buttons, sizeof(input_buttons), STATE_ALL},
+  {&input_current, sizeof(input_current), STATE_ALL},
+  {&input_last, sizeof(input_last), STATE_ALL},
+  {&lag_frames, sizeof(lag_frames), STATE_ALL},
+  {&strobe, sizeof(strobe), STATE_ALL},
+  {shift, sizeof(shift), STATE_ALL},
+  STATE_END
+};
+
+void input_reset()
+{
+  memset(input_buttons, 0, sizeof(input_buttons));
+  memset(&input_current, 0, sizeof(input_current));
+  memset(&input_last, 0, sizeof(input_last));
+  lag_frames = 0;
+  strobe = 0;
+  shift[0] = 0;
+  shift[1] = 0;
+}
+
+/* While the strobe bit is high the shift registers keep reloading */
+void input_write(uint8_t data)
+{
+  strobe = data & 0x01;
+
+  if (strobe)
+  {
+    shift[0] = input_buttons[0];
+    shift[1] = input_buttons[1];
+    input_current.strobes++;
+  }
+}
+
+/* One button per read, then 1s once all eight are out. Bit 6 is open bus
+ * from the high byte of the address. */
+uint8_t input_read(int port)
+{
+  uint8_t bit;
+  input_current.reads[port]++;
+
+  if (strobe)
+  {
+    return 0x40 | (input_buttons[port] & 0x01);
+  }
+
+  bit = shift[port] & 0x01;
+  shift[port] = (shift[port] >> 1) | 0x80;
+  return 0x40 | bit;
+}
+
+/* Called by run_frame as each frame ends */
+void input_end_frame()
+{
+  input_current.lag = !input_current.reads[0] && !input_current.reads[1];
+  lag_frames += input_current.lag;
+  input_last = input_current;
+  memset(&input_current, 0, sizeof(input_current));
+}
+
+/* Run frames until one polls input, at most max_frames. Returns the number
+ * of frames run. */
+int run_input_frame(int max_frames)
+{
+  int frames = 0;
+
+  do
+  {
+    run_frame();
+    frames++;
+  } while (input_last.lag && frames < max_frames);
+
+  return frames;
+}
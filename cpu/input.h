@@ -0,0 +1,41 @@
+#ifndef C_INPUT_H
+#define C_INPUT_H
+
+#include <stdint.h>
+
+/* Standard controllers on $4016/$4017. Reads of the ports are counted per
+ * frame so frames that never poll input can be flagged as lag frames. */
+#define INPUT_STROBE 0x4016
+#define INPUT_PORT1 0x4016
+#define INPUT_PORT2 0x4017
+#define INPUT_PAGE 0x40
+
+/* Button bits, in the order they are shifted out */
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
+
+struct input_frame
+{
+  int strobes;
+  int reads[2];
+  int lag;
+};
+
+extern uint8_t input_buttons[2];
+extern struct input_frame input_current;
+extern struct input_frame input_last;
+extern long long lag_frames;
+
+void input_reset();
+void input_write(uint8_t data);
+uint8_t input_read(int port);
+void input_end_frame();
+int run_input_frame(int max_frames);
+
+#endif
@@ -0,0 +1,400 @@
+#include "library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A ROM found while scanning, before it is written out */
+struct scan
+{
+  struct library_entry entry;
+  char* path;
+  char* name;
+  uint32_t index;
+};
+
+/* Directories already scanned, so symlink loops are entered once */
+struct visited
+{
+  dev_t device;
+  ino_t inode;
+};
+
+struct scan_list
+{
+  struct scan* items;
+  size_t count;
+  size_t capacity;
+  struct visited* visited;
+  size_t visited_count;
+};
+
+/* Hash a .nes or .zip file, -1 when it holds no usable ROM */
+static int read_header(const char* path, struct game_entry* header)
+{
+  FILE* file = fopen(path, "rb");
+  if (!file)
+  {
+    return -1;
+  }
+
+  int result = -1;
+  size_t length = strlen(path);
+  if (!strcasecmp(path + length - 4, ".zip"))
+  {
+    struct rom_image* image = read_zip(file);
+    if (image)
+    {
+      result = rom_info(image->data, image->size, header);
+      rom_cache_release(image);
+    }
+  }
+  else if (!fseek(file, 0, SEEK_END))
+  {
+    long size = ftell(file);
+    uint8_t* data = malloc(size > 0 ? size : 1);
+    rewind(file);
+    if (size > 0 && fread(data, 1, size, file) == (size_t) size)
+    {
+      result = rom_info(data, size, header);
+    }
+    free(data);
+  }
+
+  fclose(file);
+  return result;
+}
+
+/* Records of the previous index sorted by path */
+struct known
+{
+  const char* path;
+  const struct library_entry* entry;
+};
+
+struct known_list
+{
+  struct known* items;
+  size_t count;
+};
+
+static int compare_path(const void* a, const void* b)
+{
+  return strcmp(((const struct known*) a)->path, ((const struct known*) b)->path);
+}
+
+/* A record of the previous index with this path, size and mtime is reused
+ * instead of reading the file again */
+static const struct library_entry* find_unchanged(const struct known_list* known, const char* path,
+    const struct stat* info)
+{
+  struct known key = {path, NULL};
+  const struct known* found = known->count ? bsearch(&key, known->items, known->count, sizeof(struct known), compare_path) : NULL;
+  if (found && found->entry->mtime == info->st_mtime && found->entry->size == (uint32_t) info->st_size)
+  {
+    return found->entry;
+  }
+  return NULL;
+}
+
+static void scan_directory(const char* directory, const char* relative, const struct known_list* known,
+    struct scan_list* list)
+{
+  char path[4096];
+  struct stat info;
+  if ((size_t) snprintf(path, sizeof(path), "%s%s%s", directory, *relative ? "/" : "", relative) >= sizeof(path) ||
+      stat(path, &info))
+  {
+    return;
+  }
+
+  for (size_t item = 0; item < list->visited_count; item++)
+  {
+    if (list->visited[item].device == info.st_dev && list->visited[item].inode == info.st_ino)
+    {
+      return;
+    }
+  }
+  list->visited = realloc(list->visited, (list->visited_count + 1) * sizeof(struct visited));
+  list->visited[list->visited_count++] = (struct visited) {info.st_dev, info.st_ino};
+
+  DIR* dir = opendir(path);
+  if (!dir)
+  {
+    return;
+  }
+
+  struct dirent* item;
+  while ((item = readdir(dir)))
+  {
+    if (item->d_name[0] == '.')
+    {
+      continue;
+    }
+
+    /* Paths too long for the buffers are skipped rather than truncated */
+    char name[4096];
+    if ((size_t) snprintf(name, sizeof(name), "%s%s%s", relative, *relative ? "/" : "", item->d_name) >= sizeof(name) ||
+        (size_t) snprintf(path, sizeof(path), "%s/%s", directory, name) >= sizeof(path) || stat(path, &info))
+    {
+      continue;
+    }
+
+    if (S_ISDIR(info.st_mode))
+    {
+      scan_directory(directory, name, known, list);
+      continue;
+    }
+
+    size_t length = strlen(item->d_name);
+    if (length < 4 || (strcasecmp(item->d_name + length - 4, ".nes") && strcasecmp(item->d_name + length - 4, ".zip")))
+    {
+      continue;
+    }
+
+    struct library_entry entry = {0};
+    const struct library_entry* unchanged = find_unchanged(known, name, &info);
+    if (unchanged)
+    {
+      entry.header = unchanged->header;
+    }
+    else if (read_header(path, &entry.header))
+    {
+      continue;
+    }
+    entry.mtime = info.st_mtime;
+    entry.size = info.st_size;
+
+    if (list->count == list->capacity)
+    {
+      list->capacity = list->capacity ? list->capacity * 2 : 256;
+      list->items = realloc(list->items, list->capacity * sizeof(struct scan));
+    }
+
+    struct scan* scan = &list->items[list->count++];
+    scan->entry = entry;
+    scan->path = strdup(name);
+    scan->name = strndup(item->d_name, length - 4);
+  }
+
+  closedir(dir);
+}
+
+static int compare_crc(const void* a, const void* b)
+{
+  uint32_t x = ((const struct scan*) a)->entry.header.crc;
+  uint32_t y = ((const struct scan*) b)->entry.header.crc;
+  return (x > y) - (x < y);
+}
+
+static int compare_name(const void* a, const void* b)
+{
+  return strcmp((*(const struct scan* const*) a)->name, (*(const struct scan* const*) b)->name);
+}
+
+/* Scan a directory tree of .nes and .zip files into an index. An existing
+ * index at the same path is updated, only files whose size or mtime changed
+ * are read. The new index replaces the old one atomically. */
+int library_build(const char* directory, const char* index)
+{
+  struct library* previous = library_open(index);
+  struct known_list known = {0};
+  if (previous)
+  {
+    known.count = previous->count;
+    known.items = malloc((known.count ? known.count : 1) * sizeof(struct known));
+    for (size_t item = 0; item < known.count; item++)
+    {
+      known.items[item].path = library_path(previous, &previous->entries[item]);
+      known.items[item].entry = &previous->entries[item];
+    }
+    qsort(known.items, known.count, sizeof(struct known), compare_path);
+  }
+
+  struct scan_list list = {0};
+  scan_directory(directory, "", &known, &list);
+  free(list.visited);
+  free(known.items);
+  library_close(previous);
+
+  qsort(list.items, list.count, sizeof(struct scan), compare_crc);
+  struct scan** by_name = malloc((list.count ? list.count : 1) * sizeof(struct scan*));
+  uint32_t strings = 0;
+  for (size_t item = 0; item < list.count; item++)
+  {
+    list.items[item].index = item;
+    list.items[item].entry.path = strings;
+    strings += strlen(list.items[item].path) + 1;
+    list.items[item].entry.name = strings;
+    strings += strlen(list.items[item].name) + 1;
+    by_name[item] = &list.items[item];
+  }
+  qsort(by_name, list.count, sizeof(struct scan*), compare_name);
+
+  char temporary[4096];
+  FILE* file = NULL;
+  int result = -1;
+
+  if ((size_t) snprintf(temporary, sizeof(temporary), "%s.tmp", index) < sizeof(temporary))
+  {
+    file = fopen(temporary, "wb");
+  }
+
+  /* A short write leaves the old index in place */
+  if (file)
+  {
+    struct library_header header = {LIBRARY_MAGIC, list.count, 0};
+    header.strings = sizeof(header) + list.count * (sizeof(struct library_entry) + sizeof(uint32_t));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t item = 0; ok && item < list.count; item++)
+    {
+      ok = fwrite(&list.items[item].entry, sizeof(struct library_entry), 1, file) == 1;
+    }
+    for (size_t item = 0; ok && item < list.count; item++)
+    {
+      ok = fwrite(&by_name[item]->index, sizeof(uint32_t), 1, file) == 1;
+    }
+    for (size_t item = 0; ok && item < list.count; item++)
+    {
+      size_t path = strlen(list.items[item].path) + 1;
+      size_t name = strlen(list.items[item].name) + 1;
+      ok = fwrite(list.items[item].path, 1, path, file) == path && fwrite(list.items[item].name, 1, name, file) == name;
+    }
+    ok = !fclose(file) && ok;
+    result = ok && !rename(temporary, index) ? 0 : -1;
+    if (result)
+    {
+      remove(temporary);
+    }
+  }
+
+  for (size_t item = 0; item < list.count; item++)
+  {
+    free(list.items[item].path);
+    free(list.items[item].name);
+  }
+  free(list.items);
+  free(by_name);
+  return result;
+}
+
+/* Map an index read-only, NULL when it is missing or not an index */
+struct library* library_open(const char* index)
+{
+  int fd = open(index, O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) || (size_t) info.st_size < sizeof(struct library_header))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  void* base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    return NULL;
+  }
+
+  const struct library_header* header = base;
+  size_t tables = sizeof(*header) + (size_t) header->count * (sizeof(struct library_entry) + sizeof(uint32_t));
+  if (memcmp(header->magic, LIBRARY_MAGIC, sizeof(header->magic)) || header->strings != tables ||
+      tables > (size_t) info.st_size)
+  {
+    munmap(base, info.st_size);
+    return NULL;
+  }
+
+  /* Every record and name must point at a string ending inside the file */
+  const struct library_entry* entries = (const struct library_entry*) ((const uint8_t*) base + sizeof(*header));
+  const uint32_t* by_name = (const uint32_t*) (entries + header->count);
+  size_t strings = info.st_size - tables;
+  int valid = !header->count || (strings && ((const char*) base)[info.st_size - 1] == '\0');
+  for (uint32_t item = 0; valid && item < header->count; item++)
+  {
+    valid = entries[item].path < strings && entries[item].name < strings && by_name[item] < header->count;
+  }
+  if (!valid)
+  {
+    munmap(base, info.st_size);
+    return NULL;
+  }
+
+  struct library* library = malloc(sizeof(struct library));
+  library->base = base;
+  library->length = info.st_size;
+  library->count = header->count;
+  library->entries = (const struct library_entry*) (library->base + sizeof(*header));
+  library->by_name = (const uint32_t*) (library->entries + header->count);
+  library->strings = (const char*) library->base + header->strings;
+  return library;
+}
+
+void library_close(struct library* library)
+{
+  if (library)
+  {
+    munmap((void*) library->base, library->length);
+    free(library);
+  }
+}
+
+/* Binary search by the CRC of PRG+CHR */
+const struct library_entry* library_find(const struct library* library, uint32_t crc)
+{
+  uint32_t low = 0;
+  uint32_t high = library->count;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (library->entries[middle].header.crc < crc)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  return low < library->count && library->entries[low].header.crc == crc ? &library->entries[low] : NULL;
+}
+
+/* Binary search by file name without the extension */
+const struct library_entry* library_find_name(const struct library* library, const char* name)
+{
+  uint32_t low = 0;
+  uint32_t high = library->count;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (strcmp(library_name(library, &library->entries[library->by_name[middle]]), name) < 0)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  const struct library_entry* entry = low < library->count ? &library->entries[library->by_name[low]] : NULL;
+  return entry && !strcmp(library_name(library, entry), name) ? entry : NULL;
+}
+
+/* Path relative to the scanned directory */
+const char* library_path(const struct library* library, const struct library_entry* entry)
+{
+  return library->strings + entry->path;
+}
+
+const char* library_name(const struct library* library, const struct library_entry* entry)
+{
+  return library->strings + entry->name;
+}
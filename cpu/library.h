@@ -0,0 +1,47 @@
+#ifndef C_LIBRARY_H
+#define C_LIBRARY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cartridge.h"
+
+/* On-disk ROM index. A header, the records sorted by CRC, the record
+ * numbers sorted by name, then the NUL-terminated strings. Opened with
+ * mmap and searched in place. */
+#define LIBRARY_MAGIC "NESIDX1"
+
+struct library_header
+{
+  char magic[8];
+  uint32_t count;
+  uint32_t strings;
+};
+
+struct library_entry
+{
+  int64_t mtime;
+  uint32_t size;
+  uint32_t path;
+  uint32_t name;
+  struct game_entry header;
+};
+
+struct library
+{
+  const uint8_t* base;
+  size_t length;
+  uint32_t count;
+  const struct library_entry* entries;
+  const uint32_t* by_name;
+  const char* strings;
+};
+
+int library_build(const char* directory, const char* index);
+struct library* library_open(const char* index);
+void library_close(struct library* library);
+const struct library_entry* library_find(const struct library* library, uint32_t crc);
+const struct library_entry* library_find_name(const struct library* library, const char* name);
+const char* library_path(const struct library* library, const struct library_entry* entry);
+const char* library_name(const struct library* library, const struct library_entry* entry);
+
+#endif
@@ -0,0 +1,246 @@
+#include "metrics.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Every slot ever handed out, and those whose thread has exited. A new
+ * thread takes a free slot before a new one, so the list only grows to the
+ * most threads alive at once, and the counts of finished threads are kept. */
+static struct metrics_slot* slots;
+static struct metrics_slot* free_slots;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t slot_key;
+static pthread_once_t slot_once = PTHREAD_ONCE_INIT;
+static __thread struct metrics_slot* slot;
+
+/* Upper bounds of the frame time histogram in nanoseconds */
+static const uint64_t frame_bounds[METRICS_BUCKETS - 1] = {
+  250000, 500000, 1000000, 2000000, 4000000, 8000000, 16000000
+};
+
+static const char* names[] = {
+  "nes_instructions_retired_total", "nes_frames_total",
+  "nes_save_state_bytes_total", "nes_deadline_misses_total",
+  "nes_overclock_cycles_total"
+};
+
+static void release_slot(void* released)
+{
+  struct metrics_slot* local = released;
+
+  pthread_mutex_lock(&slots_lock);
+  local->next_free = free_slots;
+  free_slots = local;
+  pthread_mutex_unlock(&slots_lock);
+}
+
+static void create_key()
+{
+  pthread_key_create(&slot_key, release_slot);
+}
+
+/* The calling thread's slot, taken on its first count */
+struct metrics_slot* metrics_local()
+{
+  if (!slot)
+  {
+    pthread_once(&slot_once, create_key);
+    pthread_mutex_lock(&slots_lock);
+
+    if (free_slots)
+    {
+      slot = free_slots;
+      free_slots = slot->next_free;
+    }
+    else
+    {
+      slot = aligned_alloc(_Alignof(struct metrics_slot), sizeof(struct metrics_slot));
+      memset(slot, 0, sizeof(*slot));
+      slot->next = slots;
+      slots = slot;
+    }
+
+    pthread_mutex_unlock(&slots_lock);
+    pthread_setspecific(slot_key, slot);
+  }
+
+  return slot;
+}
+
+uint64_t metrics_now()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void metrics_frame(uint64_t host_ns, uint64_t deadline_ns)
+{
+  struct metrics_slot* local = metrics_local();
+  int bucket = 0;
+
+  while (bucket < METRICS_BUCKETS - 1 && host_ns > frame_bounds[bucket])
+  {
+    bucket++;
+  }
+
+  local->counters[metric_frames]++;
+  local->counters[metric_frame_ns] += host_ns;
+  local->counters[metric_deadline_misses] += deadline_ns && host_ns > deadline_ns;
+  local->frame_buckets[bucket]++;
+}
+
+int metrics_write(FILE* file)
+{
+  uint64_t totals[metric_count] = {0};
+  uint64_t buckets[METRICS_BUCKETS] = {0};
+  uint64_t cumulative = 0;
+
+  pthread_mutex_lock(&slots_lock);
+
+  for (const struct metrics_slot* index = slots; index; index = index->next)
+  {
+    for (int metric = 0; metric < metric_count; metric++)
+    {
+      totals[metric] += index->counters[metric];
+    }
+
+    for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+    {
+      buckets[bucket] += index->frame_buckets[bucket];
+    }
+  }
+
+  pthread_mutex_unlock(&slots_lock);
+
+  for (int metric = 0; metric < metric_frame_ns; metric++)
+  {
+    fprintf(file, "# TYPE %s counter\n%s %llu\n", names[metric], names[metric],
+      (unsigned long long) totals[metric]);
+  }
+
+  fprintf(file, "# TYPE nes_frame_seconds histogram\n");
+
+  for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++)
+  {
+    cumulative += buckets[bucket];
+
+    if (bucket < METRICS_BUCKETS - 1)
+    {
+      fprintf(file, "nes_frame_seconds_bucket{le=\"%g\"} %llu\n",
+        frame_bounds[bucket] / 1e9, (unsigned long long) cumulative);
+    }
+    else
+    {
+      fprintf(file, "nes_frame_seconds_bucket{le=\"+Inf\"} %llu\n",
+        (unsigned long long) cumulative);
+    }
+  }
+
+  fprintf(file, "nes_frame_seconds_sum %g\nnes_frame_seconds_count %llu\n",
+    totals[metric_frame_ns] / 1e9, (unsigned long long) cumulative);
+
+  return ferror(file) ? -1 : 0;
+}
+
+/* Listen on a UNIX socket for scrapers, metrics_poll answers them */
+int metrics_listen(const char* path)
+{
+  struct sockaddr_un address = {0};
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  if (listener < 0)
+  {
+    return -1;
+  }
+
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  unlink(path);
+
+  if (bind(listener, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+    listen(listener, 4) < 0)
+  {
+    close(listener);
+    return -1;
+  }
+
+  return listener;
+}
+
+/* Read the request up to its blank line, so closing the socket does not
+ * reset it with the request still unread. A scraper sends the request
+ * with the connection, the timeout only covers one that does not. */
+static void read_request(int client)
+{
+  struct timeval timeout = {0, METRICS_REQUEST_TIMEOUT_US};
+  char request[1024];
+  size_t length = 0;
+
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  while (length < sizeof(request) - 1)
+  {
+    ssize_t count = recv(client, request + length, sizeof(request) - 1 - length, 0);
+
+    if (count <= 0)
+    {
+      return;
+    }
+
+    length += count;
+    request[length] = 0;
+
+    if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+    {
+      return;
+    }
+  }
+}
+
+/* Answer every waiting connection with an HTTP response. Call this at frame
+ * boundaries. Writes use MSG_NOSIGNAL, so a scraper that hangs up early
+ * cannot raise SIGPIPE. */
+void metrics_poll(int listener)
+{
+  int client;
+
+  while ((client = accept(listener, NULL, NULL)) >= 0)
+  {
+    char* text = NULL;
+    size_t length = 0;
+    FILE* file = open_memstream(&text, &length);
+
+    if (!file)
+    {
+      close(client);
+      continue;
+    }
+
+    read_request(client);
+    fprintf(file, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n");
+    metrics_write(file);
+    fclose(file);
+
+    for (size_t sent = 0; sent < length; )
+    {
+      ssize_t count = send(client, text + sent, length - sent, MSG_NOSIGNAL);
+
+      if (count <= 0)
+      {
+        break;
+      }
+
+      sent += count;
+    }
+
+    free(text);
+    close(client);
+  }
+}
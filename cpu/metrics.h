@@ -0,0 +1,43 @@
+#ifndef C_METRICS_H
+#define C_METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Runtime counters. Each thread increments its own cache-line sized slot,
+ * metrics_write sums the slots and prints Prometheus text format. */
+#define METRICS_BUCKETS 8
+#define METRICS_REQUEST_TIMEOUT_US 100000
+
+enum metric {
+  metric_instructions, metric_frames, metric_state_bytes,
+  metric_deadline_misses, metric_overclock_cycles, metric_frame_ns,
+  metric_count
+};
+
+struct metrics_slot
+{
+  _Alignas(64) uint64_t counters[metric_count];
+  uint64_t frame_buckets[METRICS_BUCKETS];
+  struct metrics_slot* next;
+  struct metrics_slot* next_free;
+};
+
+struct metrics_slot* metrics_local();
+uint64_t metrics_now();
+void metrics_frame(uint64_t host_ns, uint64_t deadline_ns);
+int metrics_write(FILE* file);
+int metrics_listen(const char* path);
+void metrics_poll(int listener);
+
+#ifdef METRICS
+#define METRICS_ADD(metric, amount) ({ metrics_local()->counters[metric] += (amount); })
+#define METRICS_FRAME_BEGIN() uint64_t metrics_start = metrics_now()
+#define METRICS_FRAME_END(deadline_ns) ({ metrics_frame(metrics_now() - metrics_start, deadline_ns); })
+#else
+#define METRICS_ADD(metric, amount)
+#define METRICS_FRAME_BEGIN()
+#define METRICS_FRAME_END(deadline_ns)
+#endif
+
+#endif
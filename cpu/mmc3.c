@@ -0,0 +1,216 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+
+/* MMC3 (mapper 4). The scanline counter is clocked by PPU A12 rising once
+ * per rendered line, at a dot fixed by the pattern table selection. Rather
+ * than watch A12, the counter is caught up from the cycle count whenever a
+ * relevant register changes and its next IRQ is predicted as a scheduler
+ * event. */
+#define CLOCKS_PER_FRAME (VISIBLE_SCANLINES + 1)
+
+static struct
+{
+  uint8_t bank_select;
+  uint8_t registers[8];
+  uint8_t latch;
+  uint8_t counter;
+  int reload;
+  int irq_enabled;
+  long long sync_clock;
+} mmc3;
+
+const struct state_chunk mmc3_state[] = {
+  {&mmc3, sizeof(mmc3), STATE_ALL},
+  STATE_END
+};
+
+/* Dot of the A12 rise on each rendered line, -1 when A12 never rises */
+static int a12_dot(uint8_t ctrl, uint8_t mask)
+{
+  if (!(mask & MASK_RENDERING))
+  {
+    return -1;
+  }
+
+  /* 8x16 sprites are assumed to come from $1000 */
+  if (ctrl & CTRL_SPRITE_SIZE)
+  {
+    return (ctrl & CTRL_BACKGROUND_TABLE) ? -1 : 260;
+  }
+
+  switch (ctrl & (CTRL_SPRITE_TABLE | CTRL_BACKGROUND_TABLE)) {
+    case CTRL_SPRITE_TABLE:
+      return 260;
+    case CTRL_BACKGROUND_TABLE:
+      return 324;
+    default:
+      return -1;
+  }
+}
+
+/* Clocks on lines 0-239 and the pre-render line up to and including dot */
+static long long clocks_until(long long dot, int clock)
+{
+  int position = dot % DOTS_PER_REGION_FRAME;
+  int line = position / DOTS_PER_SCANLINE;
+  int passed = position % DOTS_PER_SCANLINE >= clock;
+  long long count = dot / DOTS_PER_REGION_FRAME * CLOCKS_PER_FRAME;
+
+  if (line < VISIBLE_SCANLINES)
+  {
+    return count + line + passed;
+  }
+
+  return count + VISIBLE_SCANLINES + (line == timing->scanlines - 1 && passed);
+}
+
+/* Dot of the clock numbered index, counting from 0 */
+static long long clock_position(long long index, int clock)
+{
+  int line = index % CLOCKS_PER_FRAME;
+
+  if (line == VISIBLE_SCANLINES)
+  {
+    line = timing->scanlines - 1;
+  }
+
+  return index / CLOCKS_PER_FRAME * DOTS_PER_REGION_FRAME + line * DOTS_PER_SCANLINE + clock;
+}
+
+static void apply_clocks(long long count)
+{
+  if (count <= 0)
+  {
+    return;
+  }
+
+  mmc3.counter = (mmc3.reload || !mmc3.counter) ? mmc3.latch : mmc3.counter - 1;
+  mmc3.reload = 0;
+  count--;
+
+  if (count <= mmc3.counter)
+  {
+    mmc3.counter -= count;
+  }
+  else
+  {
+    count -= mmc3.counter + 1;
+    mmc3.counter = mmc3.latch - count % (mmc3.latch + 1);
+  }
+}
+
+/* Apply the clocks since the last sync under the current PPU settings */
+static void catch_up()
+{
+  int clock = a12_dot(ppu_ctrl, ppu_mask);
+
+  if (clock >= 0)
+  {
+    apply_clocks(clocks_until(clock_dot(system_clock(cycles)), clock) - clocks_until(clock_dot(mmc3.sync_clock), clock));
+  }
+
+  mmc3.sync_clock = system_clock(cycles);
+}
+
+static void irq_event();
+
+static void predict(uint8_t ctrl, uint8_t mask)
+{
+  int clock = a12_dot(ctrl, mask);
+
+  if (!mmc3.irq_enabled || clock < 0)
+  {
+    cancel_event(irq_event);
+    return;
+  }
+
+  int needed = (mmc3.reload || !mmc3.counter) ? mmc3.latch + 1 : mmc3.counter;
+  long long dot = clock_position(clocks_until(clock_dot(system_clock(cycles)), clock) + needed - 1, clock);
+  schedule_event(clock_cycle(dot_clock(dot)), irq_event);
+}
+
+static void irq_event()
+{
+  catch_up();
+  set_irq(1);
+  predict(ppu_ctrl, ppu_mask);
+}
+
+static void ppu_changed(uint8_t ctrl, uint8_t mask)
+{
+  catch_up();
+  predict(ctrl, mask);
+}
+
+static void update_banks()
+{
+  int swap_prg = (mmc3.bank_select & 0x40) != 0;
+  int swap_chr = (mmc3.bank_select & 0x80) ? 4 : 0;
+
+  map_prg(swap_prg ? 2 : 0, mmc3.registers[6]);
+  map_prg(1, mmc3.registers[7]);
+  map_prg(swap_prg ? 0 : 2, -2);
+  map_prg(3, -1);
+
+  map_chr(swap_chr, mmc3.registers[0] & 0xFE);
+  map_chr(swap_chr + 1, mmc3.registers[0] | 0x01);
+  map_chr(swap_chr + 2, mmc3.registers[1] & 0xFE);
+  map_chr(swap_chr + 3, mmc3.registers[1] | 0x01);
+
+  for (int index = 0; index < 4; index++)
+  {
+    map_chr((swap_chr ^ 4) + index, mmc3.registers[2 + index]);
+  }
+}
+
+static void mmc3_write(uint16_t address, uint8_t data)
+{
+  switch (address & 0xE001) {
+    case 0x8000:
+      mmc3.bank_select = data;
+      update_banks();
+      break;
+    case 0x8001:
+      mmc3.registers[mmc3.bank_select & 0x07] = data;
+      update_banks();
+      break;
+    case 0xA000:
+      cartridge.vertical_mirroring = !(data & 0x01);
+      break;
+    case 0xC000:
+      catch_up();
+      mmc3.latch = data;
+      predict(ppu_ctrl, ppu_mask);
+      break;
+    case 0xC001:
+      catch_up();
+      mmc3.counter = 0;
+      mmc3.reload = 1;
+      predict(ppu_ctrl, ppu_mask);
+      break;
+    case 0xE000:
+      catch_up();
+      mmc3.irq_enabled = 0;
+      set_irq(0);
+      predict(ppu_ctrl, ppu_mask);
+      break;
+    case 0xE001:
+      catch_up();
+      mmc3.irq_enabled = 1;
+      predict(ppu_ctrl, ppu_mask);
+      break;
+    default:
+      break;
+  }
+}
+
+void mmc3_init()
+{
+  memset(&mmc3, 0, sizeof(mmc3));
+  mmc3.sync_clock = system_clock(cycles);
+  mapper_write = mmc3_write;
+  mapper_irq = irq_event;
+  mapper_ppu_changed = ppu_changed;
+  update_banks();
+}
@@ -0,0 +1,399 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+
+/* Nintendo MMC5 (mapper 5): PRG banking in all four modes, the 8x8 sprite
+ * CHR set, the multiplier, the scanline IRQ and the two pulse channels and
+ * PCM of its audio. $5204 and $5015 read through mapper_read, so reading
+ * them acknowledges the IRQ and reports the length counters. ExRAM, extended
+ * attributes, split screen and PRG-RAM banking need the PPU fetch path,
+ * which does not exist yet. The PCM read mode and its IRQ latch CPU reads of
+ * $8000-$BFFF, which go straight through the read pages, so only the write
+ * mode is supported. */
+#define MMC5_IRQ_DOT 4
+#define MMC5_IRQ_STATUS 0x5204
+#define MMC5_AUDIO_STATUS 0x5015
+/* The envelopes and length counters run off a fixed 240Hz divider of M2 */
+#define MMC5_FRAME_PERIOD 7457
+#define MMC5_LENGTH_HALT 0x20
+#define MMC5_CONSTANT_VOLUME 0x10
+
+static struct
+{
+  uint8_t prg_mode;
+  uint8_t chr_mode;
+  uint8_t prg_registers[4];
+  uint8_t chr_registers[8];
+  uint8_t multiplicand;
+  uint8_t multiplier;
+  uint8_t irq_compare;
+  int irq_enabled;
+  int irq_pending;
+} mmc5;
+
+struct mmc5_pulse
+{
+  /* Duty, length halt or envelope loop, constant volume and volume */
+  uint8_t control;
+  uint16_t period;
+  int timer;
+  uint8_t step;
+  uint8_t length;
+  uint8_t decay;
+  int envelope_timer;
+};
+
+static struct
+{
+  struct mmc5_pulse pulse[2];
+  uint8_t enabled;
+  uint8_t pcm;
+  int frame_timer;
+  long long sync_clock;
+} audio;
+
+/* Sequencer steps that output, one bit per step, for each duty */
+static const uint8_t duties[4] = {0x02, 0x06, 0x1E, 0xF9};
+
+static const uint8_t lengths[32] = {
+  10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+  12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+const struct state_chunk mmc5_state[] = {
+  {&mmc5, sizeof(mmc5), STATE_ALL},
+  {&audio, sizeof(audio), STATE_ALL},
+  STATE_END
+};
+
+static void update_prg()
+{
+  uint8_t* banks = mmc5.prg_registers;
+
+  switch (mmc5.prg_mode) {
+    case 0:
+      for (int slot = 0; slot < 4; slot++)
+      {
+        map_prg(slot, (banks[3] & 0x7C) + slot);
+      }
+      break;
+    case 1:
+      map_prg(0, banks[1] & 0x7E);
+      map_prg(1, (banks[1] & 0x7E) + 1);
+      map_prg(2, banks[3] & 0x7E);
+      map_prg(3, (banks[3] & 0x7E) + 1);
+      break;
+    case 2:
+      map_prg(0, banks[1] & 0x7E);
+      map_prg(1, (banks[1] & 0x7E) + 1);
+      map_prg(2, banks[2] & 0x7F);
+      map_prg(3, banks[3] & 0x7F);
+      break;
+    default:
+      for (int slot = 0; slot < 4; slot++)
+      {
+        map_prg(slot, banks[slot] & 0x7F);
+      }
+      break;
+  }
+}
+
+static void update_chr()
+{
+  /* 8KB, 4KB, 2KB or 1KB banks, each register naming its last slot */
+  int size = 8 >> mmc5.chr_mode;
+
+  for (int slot = 0; slot < 8; slot++)
+  {
+    int reg = slot | (size - 1);
+    map_chr(slot, mmc5.chr_registers[reg] * size + (slot & (size - 1)));
+  }
+}
+
+static void irq_event();
+
+/* The IRQ fires as rendering reaches the compare scanline */
+static void predict(uint8_t mask)
+{
+  if (!mmc5.irq_enabled || !mmc5.irq_compare || mmc5.irq_compare >= VISIBLE_SCANLINES ||
+    !(mask & MASK_RENDERING))
+  {
+    cancel_event(irq_event);
+    return;
+  }
+
+  long long dot = clock_dot(system_clock(cycles));
+  long long frame = dot - dot % DOTS_PER_REGION_FRAME;
+  long long target = frame + mmc5.irq_compare * DOTS_PER_SCANLINE + MMC5_IRQ_DOT;
+
+  if (target <= dot)
+  {
+    target += DOTS_PER_REGION_FRAME;
+  }
+
+  schedule_event(clock_cycle(dot_clock(target)), irq_event);
+}
+
+/* The line stays up until $5204 is read or the IRQ is disabled */
+static void irq_event()
+{
+  mmc5.irq_pending = 1;
+  set_irq(1);
+  predict(ppu_mask);
+}
+
+/* Called before the PPU stores the new mask, so it is passed along */
+static void ppu_changed(uint8_t ctrl, uint8_t mask)
+{
+  (void) ctrl;
+  predict(mask);
+}
+
+/* Audio: two pulse channels like the APU's, without sweep, and a raw PCM
+ * level, caught up on demand */
+
+/* Advance a divider of the given period by elapsed cycles, returning how many
+ * times it expired. The timer holds the cycles left until it next expires. */
+static int divide(int* timer, int period, int elapsed)
+{
+  if (elapsed < *timer)
+  {
+    *timer -= elapsed;
+    return 0;
+  }
+
+  elapsed -= *timer;
+  *timer = period - elapsed % period;
+  return 1 + elapsed / period;
+}
+
+static void audio_catch_up()
+{
+  int elapsed = system_clock(cycles) - audio.sync_clock;
+  audio.sync_clock = system_clock(cycles);
+
+  if (elapsed <= 0)
+  {
+    return;
+  }
+
+  int ticks = divide(&audio.frame_timer, MMC5_FRAME_PERIOD, elapsed);
+
+  for (int index = 0; index < 2; index++)
+  {
+    struct mmc5_pulse* pulse = &audio.pulse[index];
+    int halt = pulse->control & MMC5_LENGTH_HALT;
+
+    /* The sequencer steps every other cycle */
+    pulse->step = (pulse->step - divide(&pulse->timer, (pulse->period + 1) * 2, elapsed)) & 0x07;
+
+    if (!ticks)
+    {
+      continue;
+    }
+
+    if (!halt)
+    {
+      pulse->length = pulse->length > ticks ? pulse->length - ticks : 0;
+    }
+
+    /* The decay level drops once per volume + 1 ticks, wrapping when looped */
+    int decays = divide(&pulse->envelope_timer, (pulse->control & 0x0F) + 1, ticks);
+
+    if (halt)
+    {
+      pulse->decay = (pulse->decay - decays) & 0x0F;
+    }
+    else
+    {
+      pulse->decay = pulse->decay > decays ? pulse->decay - decays : 0;
+    }
+  }
+}
+
+/* Current output level, 0 to 15 for each pulse plus the PCM level */
+static int mmc5_audio()
+{
+  int level = audio.pcm;
+
+  audio_catch_up();
+
+  for (int index = 0; index < 2; index++)
+  {
+    struct mmc5_pulse* pulse = &audio.pulse[index];
+
+    if (pulse->length && (duties[pulse->control >> 6] >> pulse->step & 1))
+    {
+      level += pulse->control & MMC5_CONSTANT_VOLUME ? pulse->control & 0x0F : pulse->decay;
+    }
+  }
+
+  return level;
+}
+
+static void mmc5_audio_write(uint16_t address, uint8_t data)
+{
+  audio_catch_up();
+
+  if (address < 0x5008)
+  {
+    struct mmc5_pulse* pulse = &audio.pulse[(address >> 2) & 1];
+
+    switch (address & 0x03) {
+      case 0:
+        pulse->control = data;
+        break;
+      case 2:
+        pulse->period = (pulse->period & 0x0700) | data;
+        break;
+      case 3:
+        /* Restarts the sequencer and the envelope */
+        pulse->period = (pulse->period & 0x00FF) | ((data & 0x07) << 8);
+        pulse->step = 0;
+        pulse->decay = 15;
+        pulse->envelope_timer = (pulse->control & 0x0F) + 1;
+
+        if (audio.enabled & (1 << ((address >> 2) & 1)))
+        {
+          pulse->length = lengths[data >> 3];
+        }
+        break;
+    }
+
+    return;
+  }
+
+  switch (address) {
+    case 0x5011:
+      /* Writing 0 is ignored in write mode */
+      if (data)
+      {
+        audio.pcm = data;
+      }
+      break;
+    case MMC5_AUDIO_STATUS:
+      audio.enabled = data & 0x03;
+
+      for (int index = 0; index < 2; index++)
+      {
+        if (!(audio.enabled & (1 << index)))
+        {
+          audio.pulse[index].length = 0;
+        }
+      }
+      break;
+  }
+}
+
+/* $5015 reports which length counters are running. For $5204, bit 7 is the
+ * pending IRQ, cleared by the read, bit 6 is set while the PPU renders the
+ * visible scanlines. */
+static uint8_t mmc5_read(uint16_t address)
+{
+  if (address == MMC5_AUDIO_STATUS)
+  {
+    audio_catch_up();
+    return (audio.pulse[0].length != 0) | (audio.pulse[1].length != 0) << 1;
+  }
+
+  if (address != MMC5_IRQ_STATUS)
+  {
+    return memory[address];
+  }
+
+  long long dot = clock_dot(system_clock(cycles)) % DOTS_PER_REGION_FRAME;
+  int in_frame = (ppu_mask & MASK_RENDERING) && dot < VISIBLE_SCANLINES * DOTS_PER_SCANLINE;
+  uint8_t status = mmc5.irq_pending << 7 | in_frame << 6;
+
+  mmc5.irq_pending = 0;
+  set_irq(0);
+  return status;
+}
+
+static void mmc5_write(uint16_t address, uint8_t data)
+{
+  if (address >= 0x5000 && address <= MMC5_AUDIO_STATUS)
+  {
+    mmc5_audio_write(address, data);
+    return;
+  }
+
+  switch (address) {
+    case 0x5100:
+      mmc5.prg_mode = data & 0x03;
+      update_prg();
+      break;
+    case 0x5101:
+      mmc5.chr_mode = data & 0x03;
+      update_chr();
+      break;
+    case 0x5114:
+    case 0x5115:
+    case 0x5116:
+    case 0x5117:
+      mmc5.prg_registers[address - 0x5114] = data;
+      update_prg();
+      break;
+    case 0x5120:
+    case 0x5121:
+    case 0x5122:
+    case 0x5123:
+    case 0x5124:
+    case 0x5125:
+    case 0x5126:
+    case 0x5127:
+      mmc5.chr_registers[address - 0x5120] = data;
+      update_chr();
+      break;
+    case 0x5203:
+      mmc5.irq_compare = data;
+      predict(ppu_mask);
+      break;
+    case MMC5_IRQ_STATUS:
+      mmc5.irq_enabled = data >> 7;
+      set_irq(mmc5.irq_enabled && mmc5.irq_pending);
+      predict(ppu_mask);
+      break;
+    case 0x5205:
+    case 0x5206:
+      /* The product is read back from the same registers */
+      if (address == 0x5205)
+      {
+        mmc5.multiplicand = data;
+      }
+      else
+      {
+        mmc5.multiplier = data;
+      }
+      memory[0x5205] = (mmc5.multiplicand * mmc5.multiplier) & 0xFF;
+      memory[0x5206] = (mmc5.multiplicand * mmc5.multiplier) >> 8;
+      break;
+  }
+}
+
+void mmc5_init()
+{
+  memset(&mmc5, 0, sizeof(mmc5));
+  memset(&audio, 0, sizeof(audio));
+  audio.sync_clock = system_clock(cycles);
+  audio.frame_timer = MMC5_FRAME_PERIOD;
+
+  for (int index = 0; index < 2; index++)
+  {
+    audio.pulse[index].timer = 1;
+    audio.pulse[index].envelope_timer = 1;
+  }
+
+  mmc5.prg_mode = 3;
+  mmc5.chr_mode = 3;
+  mmc5.prg_registers[3] = 0xFF;
+  mapper_write = mmc5_write;
+  mapper_irq = irq_event;
+  mapper_read = mmc5_read;
+  mapper_ppu_changed = ppu_changed;
+  mapper_audio = mmc5_audio;
+  *HOOK_SLOT(MMC5_AUDIO_STATUS >> 8) = NULL;
+  *HOOK_SLOT(MMC5_IRQ_STATUS >> 8) = NULL;
+  update_prg();
+  update_chr();
+}
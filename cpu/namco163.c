@@ -0,0 +1,187 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+
+/* Namco 163 (mapper 19). Its wavetable channels live in 128 bytes of
+ * internal RAM, one channel is updated every 15 CPU cycles. */
+#define N163_RAM_SIZE 128
+#define N163_UPDATE_CYCLES 15
+
+static struct
+{
+  uint8_t ram[N163_RAM_SIZE];
+  uint8_t address;
+  uint16_t counter;
+  int irq_enabled;
+  long long sync_clock;
+  long long audio_clock;
+  int audio_timer;
+  int current;
+} n163;
+
+const struct state_chunk namco163_state[] = {
+  {&n163, sizeof(n163), STATE_ALL},
+  STATE_END
+};
+
+static void catch_up()
+{
+  if (n163.irq_enabled && n163.counter < 0x7FFF)
+  {
+    int counter = n163.counter + system_clock(cycles) - n163.sync_clock;
+    n163.counter = counter < 0x7FFF ? counter : 0x7FFF;
+  }
+
+  n163.sync_clock = system_clock(cycles);
+}
+
+static void irq_event();
+
+/* The counter counts up and stops at $7FFF, raising the IRQ */
+static void predict()
+{
+  if (n163.irq_enabled && n163.counter < 0x7FFF)
+  {
+    schedule_event(clock_cycle(system_clock(cycles) + 0x7FFF - n163.counter), irq_event);
+  }
+  else
+  {
+    cancel_event(irq_event);
+  }
+}
+
+static void irq_event()
+{
+  catch_up();
+  set_irq(1);
+}
+
+static int channel_count()
+{
+  return ((n163.ram[0x7F] >> 4) & 0x07) + 1;
+}
+
+/* Channels are numbered from the last, active ones take $78 downwards */
+static void advance_channel(int channel, long long updates)
+{
+  uint8_t* registers = n163.ram + 0x78 - channel * 8;
+  long long frequency = registers[0] | (registers[2] << 8) | ((registers[4] & 0x03) << 16);
+  long long length = (256 - (registers[4] & 0xFC)) << 16;
+  long long phase = registers[1] | (registers[3] << 8) | (registers[5] << 16);
+
+  phase = (phase + frequency * updates) % length;
+  registers[1] = phase & 0xFF;
+  registers[3] = (phase >> 8) & 0xFF;
+  registers[5] = phase >> 16;
+}
+
+static void audio_catch_up()
+{
+  int elapsed = system_clock(cycles) - n163.audio_clock;
+  n163.audio_clock = system_clock(cycles);
+
+  if (elapsed < n163.audio_timer)
+  {
+    n163.audio_timer -= elapsed;
+    return;
+  }
+
+  elapsed -= n163.audio_timer;
+  int updates = 1 + elapsed / N163_UPDATE_CYCLES;
+  n163.audio_timer = N163_UPDATE_CYCLES - elapsed % N163_UPDATE_CYCLES;
+
+  int channels = channel_count();
+  n163.current %= channels;
+
+  for (int offset = 0; offset < channels; offset++)
+  {
+    int channel = (n163.current + offset) % channels;
+    advance_channel(channel, updates / channels + (offset < updates % channels));
+  }
+
+  n163.current = (n163.current + updates) % channels;
+}
+
+/* Average of the active channels, -120 to 105 */
+static int n163_audio()
+{
+  int channels = channel_count();
+  int level = 0;
+
+  audio_catch_up();
+
+  for (int channel = 0; channel < channels; channel++)
+  {
+    uint8_t* registers = n163.ram + 0x78 - channel * 8;
+    int sample_address = (registers[6] + registers[5]) & 0xFF;
+    int sample = (n163.ram[(sample_address >> 1) & 0x7F] >> ((sample_address & 1) * 4)) & 0x0F;
+    level += (sample - 8) * (registers[7] & 0x0F);
+  }
+
+  return level / channels;
+}
+
+static void n163_write(uint16_t address, uint8_t data)
+{
+  switch (address & 0xF800) {
+    case 0x4800:
+      audio_catch_up();
+      n163.ram[n163.address & 0x7F] = data;
+
+      if (n163.address & 0x80)
+      {
+        n163.address = 0x80 | ((n163.address + 1) & 0x7F);
+      }
+      break;
+    case 0x5000:
+      catch_up();
+      set_irq(0);
+      n163.counter = (n163.counter & 0x7F00) | data;
+      predict();
+      break;
+    case 0x5800:
+      catch_up();
+      set_irq(0);
+      n163.counter = (n163.counter & 0x00FF) | ((data & 0x7F) << 8);
+      n163.irq_enabled = data >> 7;
+      predict();
+      break;
+    case 0x8000:
+    case 0x8800:
+    case 0x9000:
+    case 0x9800:
+    case 0xA000:
+    case 0xA800:
+    case 0xB000:
+    case 0xB800:
+      map_chr((address - 0x8000) >> 11, data);
+      break;
+    case 0xE000:
+      map_prg(0, data & 0x3F);
+      break;
+    case 0xE800:
+      map_prg(1, data & 0x3F);
+      break;
+    case 0xF000:
+      map_prg(2, data & 0x3F);
+      break;
+    case 0xF800:
+      n163.address = data;
+      break;
+  }
+}
+
+void n163_init()
+{
+  memset(&n163, 0, sizeof(n163));
+  n163.sync_clock = system_clock(cycles);
+  n163.audio_clock = system_clock(cycles);
+  n163.audio_timer = N163_UPDATE_CYCLES;
+  mapper_write = n163_write;
+  mapper_irq = irq_event;
+  mapper_audio = n163_audio;
+  map_prg(0, 0);
+  map_prg(1, 1);
+  map_prg(2, 2);
+  map_prg(3, -1);
+}
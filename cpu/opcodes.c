@@ -23,9 +23,8 @@ void ADC(uint8_t value)
   }
   else
   {
-    setflag(n, result & highbit(result));
-    setflag(v, !((accumulator ^ value) & 0x80) && ((accumulator ^ result) & 0x80));
-    setflag(c, result > 0xFF);
+    processor_status = (processor_status & 0x3C) | nzc_flags[result] |
+      overflow_flags[OVERFLOW_INDEX(accumulator, value, result)];
   }
 
   accumulator = (uint8_t) result;
@@ -42,8 +41,7 @@ void ALR(uint8_t value)
   accumulator &= value;
   setflag(c, accumulator & 0x01);
   accumulator >>= 1;
-  setflag(z, !accumulator);
-  setflag(n, accumulator & highbit(accumulator));
+  SET_NZ(accumulator);
 }
 
 /* And value with accumulator then move Negative flag to Carry flag */
@@ -57,8 +55,7 @@ void ANC(uint8_t value)
 void AND(uint8_t value)
 {
   uint8_t result = value & accumulator;
-  setflag(n, result & highbit(result));
-  setflag(z, result & highbit(result));
+  SET_NZ(result);
   accumulator = result;
 }
 
@@ -97,22 +94,13 @@ void ARR(uint8_t value)
   accumulator = result;
 }
 
-void ASL(uint8_t value, uint16_t address, int mode)
+uint8_t ASL(uint8_t value)
 {
   setflag(c, value & 0x80);
   value <<= 1;
   value &= 0xFF;
-  setflag(n, value & highbit(value));
-  setflag(z, !value);
-
-  if (mode)
-  {
-    write(address, value);
-  }
-  else
-  {
-    accumulator = value;
-  }
+  SET_NZ(value);
+  return value;
 }
 
 void AXS()
@@ -124,7 +112,7 @@ void AXS()
 
 void Branch(uint8_t value)
 {
-  cycles = ((pc & 0xFF00) != (RELATIVE(pc, value) & 0xFF00) ? 2 : 1);
+  cycles += ((pc & 0xFF00) != (RELATIVE(pc, value) & 0xFF00) ? 2 : 1);
   pc = RELATIVE(pc, value);
 }
 
@@ -144,11 +132,18 @@ void BCS(uint8_t value)
   }
 }
 
+void BEQ(uint8_t value)
+{
+  if (getflag(z))
+  {
+    Branch(value);
+  }
+}
+
+/* N and V are bits 7 and 6 of the operand, Z comes from the AND */
 void BIT(uint8_t value)
 {
-  setflag(n, value & highbit(value));
-  setflag(v, 0x40 & value);
-  setflag(z, value & accumulator);
+  processor_status = (processor_status & 0x3D) | (value & 0xC0) | (nz_flags[value & accumulator] & 0x02);
 }
 
 void BMI(uint8_t value)
@@ -177,12 +172,14 @@ void BPL(uint8_t value)
 
 void BRK()
 {
+  TRACE_BEGIN(trace_interrupt);
   pc++;
   push_stack16(pc & 0xFF);
   setflag(b, 1);
   push_stack8(processor_status);
   setflag(i, 1);
   pc = ADDR_16(0xFFFE);
+  TRACE_END(trace_interrupt);
 }
 
 void BVC(uint8_t value)
@@ -201,50 +198,45 @@ void BVS(uint8_t value)
   }
 }
 
-void CLC(uint8_t value)
+void CLC()
 {
   setflag(c, 0);
 }
 
-void CLD(uint8_t value)
+void CLD()
 {
   setflag(d, 0);
 }
 
-void CLI(uint8_t value)
+void CLI()
 {
   setflag(i, 0);
 }
 
-void CLV(uint8_t value)
+void CLV()
 {
   setflag(v, 0);
 }
 
-void CMP(uint8_t value)
+/* reg - value is reg + ~value + 1, which carries when reg >= value */
+static void compare(uint8_t reg, uint8_t value)
 {
-  uint16_t val = accumulator - value;
+  processor_status = (processor_status & 0x7C) | nzc_flags[reg + (uint8_t) ~value + 1];
+}
 
-  /* If val = 0, accumulator = value. If val < 0, accumulator < value. */
-  setflag(n, val & highbit(val));
-  setflag(c, val < 0x100);
-  setflag(z, val &= 0xFF);
+void CMP(uint8_t value)
+{
+  compare(accumulator, value);
 }
 
 void CPX(uint8_t value)
 {
-  uint16_t val = index_x - value;
-  setflag(n, val & highbit(val));
-  setflag(c, val < 0x100);
-  setflag(z, !val);
+  compare(index_x, value);
 }
 
 void CPY(uint8_t value)
 {
-  uint16_t val = index_y - value;
-  setflag(n, val & highbit(val));
-  setflag(c, val < 0x100);
-  setflag(z, !val);
+  compare(index_y, value);
 }
 
 void DCP(uint8_t value)
@@ -258,8 +250,7 @@ void DCP(uint8_t value)
 void DEC(uint16_t address, uint8_t value)
 {
   uint8_t val = (value - 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   write(address, val);
 }
 
@@ -267,8 +258,7 @@ void DEX()
 {
   uint8_t val = index_x;
   val = (val - 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_x = val;
 }
 
@@ -276,33 +266,29 @@ void DEY()
 {
   uint8_t val = index_y;
   val = (val - 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_y = val;
 }
 
 void EOR(uint8_t value)
 {
   uint8_t val = value ^ accumulator;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   accumulator = val;
 }
 
 void INC(uint16_t address, uint8_t value)
 {
   uint8_t val = (value + 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
-  write(address, value);
+  SET_NZ(val);
+  write(address, val);
 }
 
 void INX()
 {
   uint8_t val = index_x;
   val = (val + 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_x = val;
 }
 
@@ -310,8 +296,7 @@ void INY()
 {
   uint8_t val = index_y;
   val = (val + 1) & 0xFF;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_y = val;
 }
 
@@ -325,8 +310,7 @@ void ISC(uint8_t value)
   {
     result = (accumulator - result);
     setflag(v, ((accumulator ^ value) & (accumulator ^ result)) & highbit((accumulator ^ value) & (accumulator ^ result)));
-    setflag(n, result & highbit(result));
-    setflag(z, !result);
+    SET_NZ(result);
   }
   else
   {
@@ -348,8 +332,7 @@ void ISC(uint8_t value)
 
     uint8_t temp0 = accumulator - result;
     setflag(v, ((accumulator ^ value) & (accumulator ^ temp0)) & highbit((accumulator ^ value) & (accumulator ^ temp0)));
-    setflag(n, temp0 & highbit(temp0));
-    setflag(z, !temp0);
+    SET_NZ(temp0);
 
   }
 
@@ -371,58 +354,43 @@ void JSR(uint16_t address)
 void LAS(uint8_t value)
 {
   accumulator = index_x = sp &= value;
-  setflag(n, accumulator & highbit(accumulator));
-  setflag(z, !accumulator);
+  SET_NZ(accumulator);
 }
 
 void LAX(uint8_t value)
 {
   accumulator = index_x = value;
-  setflag(n, accumulator & highbit(accumulator));
-  setflag(z, !accumulator);
+  SET_NZ(accumulator);
 }
 
 void LDA(uint8_t value)
 {
-  setflag(n, value & highbit(value));
-  setflag(z, !value);
+  SET_NZ(value);
   accumulator = value;
 }
 
 void LDX(uint8_t value)
 {
-  setflag(n, value & highbit(value));
-  setflag(z, !value);
+  SET_NZ(value);
   index_x = value;
 }
 
 void LDY(uint8_t value)
 {
-  setflag(n, value & highbit(value));
-  setflag(z, !value);
+  SET_NZ(value);
   index_y = value;
 }
 
-void LSR(uint8_t value, uint16_t address, int mode)
+uint8_t LSR(uint8_t value)
 {
   uint8_t val = value;
   setflag(c, val & 0x01);
   val >>= 1;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
-
-  /* If mode = 1, then we write to address.  */
-  if (mode)
-  {
-    write(address, val);
-  }
-  else
-  {
-    accumulator = val;
-  }
+  SET_NZ(val);
+  return val;
 }
 
-void NOP(uint8_t value)
+void NOP()
 {
   /* Command does nothing */
 }
@@ -430,8 +398,7 @@ void NOP(uint8_t value)
 void ORA(uint8_t value)
 {
   uint8_t val = value | accumulator;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   accumulator = val;
 }
 
@@ -445,14 +412,13 @@ void PHP()
   push_stack8(processor_status);
 }
 
-void PLA(uint8_t value)
+void PLA()
 {
   accumulator = pop_stack8();
-  setflag(n, accumulator & highbit(accumulator));
-  setflag(z, !accumulator);
+  SET_NZ(accumulator);
 }
 
-void PLP(uint8_t value)
+void PLP()
 {
   processor_status = pop_stack8();
 }
@@ -472,47 +438,28 @@ void RLA(uint8_t value)
   }
 
   accumulator &= val;
-  setflag(n, accumulator & highbit(accumulator));
-  setflag(z, !accumulator);
+  SET_NZ(accumulator);
 }
 
-void ROL(uint8_t value, uint16_t address, int mode)
+uint8_t ROL(uint8_t value)
 {
   uint16_t _val = value << 1;
   if (getflag(c)) _val |= 0x1;
   setflag(c, _val > 0xFF);
   _val &= 0xFF;
   uint8_t val = (uint8_t) _val;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
-
-  if (mode)
-  {
-    write(address, val);
-  }
-  else
-  {
-    accumulator = val;
-  }
+  SET_NZ(val);
+  return val;
 }
 
-void ROR(uint8_t value, uint16_t address, int mode)
+uint8_t ROR(uint8_t value)
 {
-  uint8_t val = value;
+  uint16_t val = value;
   if (getflag(c)) val |= 0x100;
   setflag(c, val & 0x01);
   val >>= 1;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
-
-  if (mode)
-  {
-    write(address, val);
-  }
-  else
-  {
-    accumulator = val;
-  }
+  SET_NZ(val);
+  return (uint8_t) val;
 }
 
 void RRA(uint8_t value)
@@ -563,13 +510,13 @@ void RRA(uint8_t value)
   }
 }
 
-void RTI(uint8_t value)
+void RTI()
 {
   processor_status = pop_stack8();
   pc = pop_stack16();
 }
 
-void RTS(uint8_t value)
+void RTS()
 {
   pc = pop_stack16() + 1;
 }
@@ -579,41 +526,45 @@ void SAX(uint8_t value)
   index_x &= accumulator;
   setflag(c, index_x >= value);
   index_x -= value;
-  setflag(n, index_x & highbit(index_x));
-  setflag(z, !index_x);
+  SET_NZ(index_x);
 }
 
+/* A - M - borrow is A + ~M + C, so the add tables give the flags from the
+ * inverted operand */
 void SBC(uint8_t value)
 {
-  uint16_t val = accumulator - value - (getflag(c) ? 0 : 1);
-  setflag(n, val & highbit(val));
-  setflag(z, val & 0xFF);
-  setflag(v, ((accumulator ^ val) & 0x80) && ((accumulator ^ value) & 0x80));
+  int borrow = !getflag(c);
+  uint8_t inverted = ~value;
+  uint16_t result = accumulator + inverted + !borrow;
+
+  processor_status = (processor_status & 0x3C) | nzc_flags[result] |
+    overflow_flags[OVERFLOW_INDEX(accumulator, inverted, result)];
 
   if (getflag(d))
   {
-    if (((accumulator & 0xF) - (getflag(c) ? 0 : 1)) < (value & 0xF))
-      val -= 0x06;
+    result = accumulator - value - borrow;
+
+    if (((accumulator & 0xF) - borrow) < (value & 0xF))
+      result -= 0x06;
 
-    if (val > 0x99)
-      val -= 0x60;
+    if (result > 0x99)
+      result -= 0x60;
   }
 
-  setflag(c, val < 0x100);
-  accumulator = (uint8_t) (val & 0xFF);
+  accumulator = (uint8_t) result;
 }
 
-void SEC(uint8_t value)
+void SEC()
 {
   setflag(c, 1);
 }
 
-void SED(uint8_t value)
+void SED()
 {
   setflag(d, 1);
 }
 
-void SEI(uint8_t value)
+void SEI()
 {
   setflag(i, 1);
 }
@@ -633,13 +584,20 @@ void SRE(uint8_t value)
   setflag(c, value & 0x01);
   value >>= 1;
   accumulator ^= value;
-  setflag(n, accumulator & highbit(accumulator));
-  setflag(z, !accumulator);
+  SET_NZ(accumulator);
 }
 
-void STA(uint16_t address, uint8_t value)
+void STA(uint16_t address)
 {
-  write(address, value);
+  write(address, accumulator);
+}
+
+/* Jams the CPU. It stays on the opcode, taking no interrupts, while the
+ * rest of the system carries on, until it is reset. */
+void STP()
+{
+  jammed = 1;
+  pc--;
 }
 
 void STX(uint16_t address)
@@ -662,32 +620,28 @@ void TAS(uint16_t address)
 void TAX()
 {
   uint8_t val = accumulator;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_x = val;
 }
 
 void TAY()
 {
   uint8_t val = accumulator;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_y = val;
 }
 
 void TSX()
 {
   uint8_t val = sp;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   index_x = val;
 }
 
 void TXA()
 {
   uint8_t val = index_x;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   accumulator = val;
 }
 
@@ -700,15 +654,13 @@ void TXS()
 void TYA()
 {
   uint8_t val = index_y;
-  setflag(n, val & highbit(val));
-  setflag(z, !val);
+  SET_NZ(val);
   accumulator = val;
 }
 
 void XAA(uint8_t value)
 {
   uint8_t result = accumulator & index_x & value;
-  setflag(n, result & highbit(result));
-  setflag(z, !result);
+  SET_NZ(result);
   accumulator &= index_x & (value | 0xEF);
 }
@@ -14,6 +14,7 @@ struct instruction
 };
 
 extern struct instruction instruction_set[256];
+extern void (*const opcode_table[256])(uint16_t address);
 
 void ADC(uint8_t value);
 void AHX(uint16_t address);
@@ -21,7 +22,7 @@ void ALR(uint8_t value);
 void ANC(uint8_t value);
 void AND(uint8_t value);
 void ARR(uint8_t value);
-void ASL(uint8_t value, uint16_t address, int mode);
+uint8_t ASL(uint8_t value);
 void AXS();
 void Branch(uint8_t value);
 void BCC(uint8_t value);
@@ -34,10 +35,10 @@ void BPL(uint8_t value);
 void BRK();
 void BVC(uint8_t value);
 void BVS(uint8_t value);
-void CLC(uint8_t value);
-void CLD(uint8_t value);
-void CLI(uint8_t value);
-void CLV(uint8_t value);
+void CLC();
+void CLD();
+void CLI();
+void CLV();
 void CMP(uint8_t value);
 void CPX(uint8_t value);
 void CPY(uint8_t value);
@@ -57,27 +58,28 @@ void LAX(uint8_t value);
 void LDA(uint8_t value);
 void LDX(uint8_t value);
 void LDY(uint8_t value);
-void LSR(uint8_t value, uint16_t address, int mode);
-void NOP(uint8_t value);
+uint8_t LSR(uint8_t value);
+void NOP();
 void ORA(uint8_t value);
 void PHA();
 void PHP();
-void PLA(uint8_t value);
-void PLP(uint8_t value);
+void PLA();
+void PLP();
 void RLA(uint8_t value);
-void ROL(uint8_t value, uint16_t address, int mode);
-void ROR(uint8_t value, uint16_t address, int mode);
+uint8_t ROL(uint8_t value);
+uint8_t ROR(uint8_t value);
 void RRA(uint8_t value);
-void RTI(uint8_t value);
-void RTS(uint8_t value);
+void RTI();
+void RTS();
 void SAX(uint8_t value);
 void SBC(uint8_t value);
-void SEC(uint8_t value);
-void SED(uint8_t value);
-void SEI(uint8_t value);
+void SEC();
+void SED();
+void SEI();
 void SLO(uint8_t value);
 void SRE(uint8_t value);
-void STA(uint16_t address, uint8_t value);
+void STA(uint16_t address);
+void STP();
 void STX(uint16_t address);
 void STY(uint16_t address);
 void TAS(uint16_t address);
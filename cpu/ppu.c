@@ -0,0 +1,40 @@
+#include "ppu.h"
+#include "cpu.h"
+
+uint8_t ppu_ctrl;
+uint8_t ppu_mask;
+
+const struct state_chunk ppu_state[] = {
+  {&ppu_ctrl, sizeof(ppu_ctrl), STATE_ALL},
+  {&ppu_mask, sizeof(ppu_mask), STATE_ALL},
+  STATE_END
+};
+
+void ppu_reset()
+{
+  ppu_ctrl = 0;
+  ppu_mask = 0;
+}
+
+void ppu_write(uint16_t address, uint8_t data)
+{
+  switch (address & 0x2007) {
+    case PPU_CTRL:
+      if (mapper_ppu_changed && ((ppu_ctrl ^ data) & (CTRL_SPRITE_TABLE |
+        CTRL_BACKGROUND_TABLE | CTRL_SPRITE_SIZE)))
+      {
+        mapper_ppu_changed(data, ppu_mask);
+      }
+      ppu_ctrl = data;
+      break;
+    case PPU_MASK:
+      if (mapper_ppu_changed && ((ppu_mask ^ data) & MASK_RENDERING))
+      {
+        mapper_ppu_changed(ppu_ctrl, data);
+      }
+      ppu_mask = data;
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef C_PPU_H
+#define C_PPU_H
+
+#include <stdint.h>
+
+/* Only the registers mappers care about are modelled. The PPU position is
+ * derived from the CPU cycle count at the region's dot ratio. Frame sizes
+ * here are NTSC's, see region.h for the others. */
+#define DOTS_PER_SCANLINE 341
+#define SCANLINES 262
+#define DOTS_PER_FRAME (DOTS_PER_SCANLINE * SCANLINES)
+#define VISIBLE_SCANLINES 240
+#define PRERENDER_SCANLINE 261
+
+#define PPU_CTRL 0x2000
+#define PPU_MASK 0x2001
+
+/* PPUCTRL and PPUMASK bits */
+#define CTRL_SPRITE_TABLE 0x08
+#define CTRL_BACKGROUND_TABLE 0x10
+#define CTRL_SPRITE_SIZE 0x20
+#define CTRL_NMI 0x80
+#define MASK_RENDERING 0x18
+
+extern uint8_t ppu_ctrl;
+extern uint8_t ppu_mask;
+
+void ppu_reset();
+void ppu_write(uint16_t address, uint8_t data);
+
+#endif
@@ -0,0 +1,162 @@
+#include "region.h"
+#include "cpu.h"
+
+const struct timing* timing;
+static enum region region;
+long long frame_count;
+
+/* CPU cycles added by overclocking so far, and the latest window */
+long long overclock_cycles;
+static long long window_start;
+static long long window_end;
+static int overclock_scanlines;
+static enum overclock_mode overclock_mode;
+
+const struct state_chunk region_state[] = {
+  {&timing, sizeof(timing), STATE_CONTEXT},
+  {&region, sizeof(region), STATE_ALL},
+  {&frame_count, sizeof(frame_count), STATE_ALL},
+  {&overclock_cycles, sizeof(overclock_cycles), STATE_ALL},
+  {&window_start, sizeof(window_start), STATE_ALL},
+  {&window_end, sizeof(window_end), STATE_ALL},
+  {&overclock_scanlines, sizeof(overclock_scanlines), STATE_ALL},
+  {&overclock_mode, sizeof(overclock_mode), STATE_ALL},
+  STATE_END
+};
+
+/* DMC periods in CPU cycles */
+static const int ntsc_dmc_rates[16] = {
+  428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+static const int pal_dmc_rates[16] = {
+  398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118, 98, 78, 66, 50
+};
+
+/* Run until the PPU reaches the end of the frame, with vblank raised on the
+ * way. clock * num < dot * den compares against the fractional clock ratio
+ * without dividing. frame_ns is the real-time length of a frame, which
+ * metrics count as the deadline. */
+#define RUN_FRAME(name, lines, vblank_line, num, den, frame_ns) \
+static void name() \
+{ \
+  METRICS_FRAME_BEGIN(); \
+  long long start = frame_count * (lines) * DOTS_PER_SCANLINE; \
+  long long end = start + (lines) * DOTS_PER_SCANLINE; \
+  long long vblank_dot = start + (vblank_line) * DOTS_PER_SCANLINE + 1; \
+  schedule_event((vblank_dot * (den) + (num) - 1) / (num) + overclock_cycles, vblank); \
+  if (overclock_scanlines) \
+  { \
+    long long dot = overclock_mode == overclock_vblank ? vblank_dot : start + VISIBLE_SCANLINES * DOTS_PER_SCANLINE; \
+    schedule_event((dot * (den) + (num) - 1) / (num) + overclock_cycles, overclock); \
+  } \
+  TRACE_BEGIN(trace_cpu); \
+  while ((cycles - overclock_cycles) * (num) < end * (den)) \
+  { \
+    perform_instruction(READ(pc), pc); \
+  } \
+  TRACE_END(trace_cpu); \
+  frame_count++; \
+  input_end_frame(); \
+  cheat_end_frame(); \
+  HOOK_END_FRAME(); \
+  METRICS_FRAME_END(frame_ns); \
+}
+
+RUN_FRAME(run_frame_ntsc, SCANLINES, NTSC_VBLANK_SCANLINE, 3, 1, NTSC_FRAME_NS)
+RUN_FRAME(run_frame_pal, PAL_SCANLINES, PAL_VBLANK_SCANLINE, 16, 5, PAL_FRAME_NS)
+RUN_FRAME(run_frame_dendy, PAL_SCANLINES, DENDY_VBLANK_SCANLINE, 3, 1, PAL_FRAME_NS)
+
+/* Dendy runs NTSC's clock ratio and APU with PAL's frame length */
+static const struct timing timings[] = {
+  {region_ntsc, SCANLINES, NTSC_VBLANK_SCANLINE, 3, 1, ntsc_dmc_rates, run_frame_ntsc},
+  {region_pal, PAL_SCANLINES, PAL_VBLANK_SCANLINE, 16, 5, pal_dmc_rates, run_frame_pal},
+  {region_dendy, PAL_SCANLINES, DENDY_VBLANK_SCANLINE, 3, 1, ntsc_dmc_rates, run_frame_dendy}
+};
+
+void timing_reset()
+{
+  frame_count = 0;
+  overclock_cycles = 0;
+  window_start = 0;
+  window_end = 0;
+  overclock_scanlines = 0;
+  set_region(region_ntsc);
+}
+
+void set_region(enum region to)
+{
+  region = to;
+  timing = &timings[region];
+}
+
+/* Snapshots keep the region rather than the table entry */
+void restore_timing()
+{
+  timing = &timings[region];
+}
+
+/* Give the CPU scanlines extra lines of time each frame, either as
+ * rendering ends or as vblank starts. 0 turns it off. */
+void set_overclock(int scanlines, enum overclock_mode mode)
+{
+  overclock_scanlines = scanlines;
+  overclock_mode = mode;
+}
+
+void run_frame()
+{
+  timing->run_frame();
+}
+
+/* Start of vblank, the only PPU event the CPU sees */
+void vblank()
+{
+  if (ppu_ctrl & CTRL_NMI)
+  {
+    nmi();
+  }
+}
+
+/* Open an overclock window. Everything already scheduled is pushed back by
+ * its length, so the PPU, APU and mappers carry on where they stopped once
+ * the CPU has had its extra time. */
+void overclock()
+{
+  int extra = dot_clock((long long) overclock_scanlines * DOTS_PER_SCANLINE);
+  window_start = cycles;
+  window_end = cycles + extra;
+  overclock_cycles += extra;
+  scheduler_delay(extra);
+  METRICS_ADD(metric_overclock_cycles, extra);
+}
+
+/* System clock at a CPU cycle, held still inside the latest window */
+long long system_clock(long long cycle)
+{
+  long long before = overclock_cycles - (window_end - window_start);
+
+  if (cycle >= window_end)
+  {
+    return cycle - overclock_cycles;
+  }
+
+  return (cycle >= window_start ? window_start : cycle) - before;
+}
+
+/* CPU cycle of a system clock from now on */
+long long clock_cycle(long long clock)
+{
+  return clock + overclock_cycles;
+}
+
+long long clock_dot(long long clock)
+{
+  return clock * timing->dots / timing->cycles;
+}
+
+/* First system clock at or after a dot */
+long long dot_clock(long long dot)
+{
+  return (dot * timing->cycles + timing->dots - 1) / timing->dots;
+}
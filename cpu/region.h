@@ -0,0 +1,55 @@
+#ifndef C_REGION_H
+#define C_REGION_H
+
+#include <stdint.h>
+#include "cartridge.h"
+
+/* Region timing. Each region gets its own frame loop with the constants
+ * folded in at compile time, picked through timing->run_frame when the
+ * region is set. Cold paths such as mapper IRQ prediction read the
+ * constants from the table instead.
+ *
+ * Overclocking inserts windows of extra CPU cycles once a frame. The PPU,
+ * APU and cartridge run on the system clock, which stands still during a
+ * window, so they convert with system_clock and clock_cycle. */
+#define PAL_SCANLINES 312
+#define NTSC_VBLANK_SCANLINE 241
+#define PAL_VBLANK_SCANLINE 241
+#define DENDY_VBLANK_SCANLINE 291
+/* Frame lengths at 60.0988Hz and 50.0070Hz, Dendy runs at PAL's rate */
+#define NTSC_FRAME_NS 16639267
+#define PAL_FRAME_NS 19997194
+
+enum overclock_mode {overclock_post_render, overclock_vblank};
+
+struct timing
+{
+  enum region region;
+  int scanlines;
+  int vblank_scanline;
+  /* PPU dots per CPU cycle as a fraction, 3 or 3.2 */
+  int dots;
+  int cycles;
+  const int* dmc_rates;
+  void (*run_frame)();
+};
+
+extern const struct timing* timing;
+extern long long frame_count;
+extern long long overclock_cycles;
+
+void timing_reset();
+void set_region(enum region region);
+void restore_timing();
+void set_overclock(int scanlines, enum overclock_mode mode);
+void run_frame();
+void vblank();
+void overclock();
+long long system_clock(long long cycle);
+long long clock_cycle(long long clock);
+long long clock_dot(long long clock);
+long long dot_clock(long long dot);
+
+#define DOTS_PER_REGION_FRAME (timing->scanlines * DOTS_PER_SCANLINE)
+
+#endif
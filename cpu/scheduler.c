@@ -0,0 +1,114 @@
+#include "scheduler.h"
+#include "cpu.h"
+
+long long next_event = LLONG_MAX;
+
+static struct event events[SCHEDULER_SIZE];
+static int event_count;
+
+const struct state_chunk scheduler_state[] = {
+  {&next_event, sizeof(next_event), STATE_ALL},
+  {events, sizeof(events), STATE_ALL},
+  {&event_count, sizeof(event_count), STATE_ALL},
+  STATE_END
+};
+
+/* Every callback an event can have, the board's IRQ being whatever
+ * mapper_irq points at */
+static void (*const callbacks[])() = {vblank, overclock, oam_dma, dmc_fetch};
+
+#define MAPPER_IRQ_EVENT ((int) (sizeof(callbacks) / sizeof(callbacks[0])))
+
+static int event_kind(void (*callback)())
+{
+  int kind = 0;
+  while (kind < MAPPER_IRQ_EVENT && callbacks[kind] != callback)
+  {
+    kind++;
+  }
+  return kind;
+}
+
+static void cancel_kind(int kind)
+{
+  for (int index = 0; index < event_count; index++)
+  {
+    if (events[index].kind == kind)
+    {
+      event_count--;
+
+      for (; index < event_count; index++)
+      {
+        events[index] = events[index + 1];
+      }
+
+      break;
+    }
+  }
+
+  update_next_event();
+}
+
+void scheduler_reset()
+{
+  event_count = 0;
+  update_next_event();
+}
+
+/* A held IRQ line keeps run_events called until the CPU takes it */
+void update_next_event()
+{
+  next_event = irq_line ? LLONG_MIN : event_count ? events[0].cycle : LLONG_MAX;
+}
+
+/* A callback is scheduled at most once, scheduling it again moves it */
+void schedule_event(long long cycle, void (*callback)())
+{
+  int index;
+  int kind = event_kind(callback);
+
+  cancel_kind(kind);
+
+  for (index = event_count; index > 0 && events[index - 1].cycle > cycle; index--)
+  {
+    events[index] = events[index - 1];
+  }
+
+  events[index].cycle = cycle;
+  events[index].kind = kind;
+  event_count++;
+  update_next_event();
+}
+
+void cancel_event(void (*callback)())
+{
+  cancel_kind(event_kind(callback));
+}
+
+/* Push every pending event back, for time the rest of the system does not
+ * see */
+void scheduler_delay(int amount)
+{
+  for (int index = 0; index < event_count; index++)
+  {
+    events[index].cycle += amount;
+  }
+
+  update_next_event();
+}
+
+/* Fire every event that is due. Callbacks may schedule further events. */
+void run_events()
+{
+  while (event_count && events[0].cycle <= cycles)
+  {
+    int kind = events[0].kind;
+    cancel_kind(kind);
+    (kind < MAPPER_IRQ_EVENT ? callbacks[kind] : mapper_irq)();
+  }
+
+  if (irq_line && !getflag(i))
+  {
+    irq();
+  }
+}
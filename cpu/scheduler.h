@@ -0,0 +1,29 @@
+#ifndef C_SCHEDULER_H
+#define C_SCHEDULER_H
+
+#include <limits.h>
+
+/* Timed events ordered by the CPU cycle they fire on. The dispatch loop only
+ * compares cycles against next_event, so idle subsystems cost nothing. */
+#define SCHEDULER_SIZE 8
+
+/* Events are kept by kind rather than by callback, so snapshots hold no
+ * function pointers */
+struct event
+{
+  long long cycle;
+  int kind;
+};
+
+extern long long next_event;
+
+void scheduler_reset();
+void schedule_event(long long cycle, void (*callback)());
+void cancel_event(void (*callback)());
+void run_events();
+void update_next_event();
+void scheduler_delay(int amount);
+
+#define RUN_EVENTS() ({ if (cycles >= next_event) run_events(); })
+
+#endif
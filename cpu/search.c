@@ -0,0 +1,224 @@
+#include "search.h"
+#include "cpu.h"
+#include <string.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Candidate n is RAM byte n, then PRG-RAM from $6000 */
+#define SEARCH_ADDRESS(index) ((index) < SEARCH_RAM_SIZE ? (index) : \
+  SEARCH_PRG_RAM + (index) - SEARCH_RAM_SIZE)
+
+/* Bit n set when byte n of the 16 at before and after passes the filter */
+static unsigned filter_mask(const uint8_t* before, const uint8_t* after,
+    enum search_filter filter, uint8_t value)
+{
+#ifdef __SSE2__
+  __m128i old = _mm_loadu_si128((const __m128i*) before);
+  __m128i new = _mm_loadu_si128((const __m128i*) after);
+  __m128i pass;
+
+  switch (filter) {
+    case search_increased:
+      pass = _mm_andnot_si128(_mm_cmpeq_epi8(old, new), _mm_cmpeq_epi8(_mm_max_epu8(old, new), new));
+      break;
+    case search_decreased:
+      pass = _mm_andnot_si128(_mm_cmpeq_epi8(old, new), _mm_cmpeq_epi8(_mm_max_epu8(old, new), old));
+      break;
+    case search_changed:
+      return ~_mm_movemask_epi8(_mm_cmpeq_epi8(old, new)) & 0xFFFF;
+    case search_unchanged:
+      pass = _mm_cmpeq_epi8(old, new);
+      break;
+    case search_equal:
+      pass = _mm_cmpeq_epi8(new, _mm_set1_epi8(value));
+      break;
+    default:
+      pass = _mm_cmpeq_epi8(_mm_sub_epi8(new, old), _mm_set1_epi8(value));
+      break;
+  }
+
+  return _mm_movemask_epi8(pass);
+#else
+  unsigned mask = 0;
+
+  for (int index = 0; index < 16; index++)
+  {
+    uint8_t old = before[index];
+    uint8_t new = after[index];
+    int pass;
+
+    switch (filter) {
+      case search_increased:
+        pass = new > old;
+        break;
+      case search_decreased:
+        pass = new < old;
+        break;
+      case search_changed:
+        pass = new != old;
+        break;
+      case search_unchanged:
+        pass = new == old;
+        break;
+      case search_equal:
+        pass = new == value;
+        break;
+      default:
+        pass = (uint8_t) (new - old) == value;
+        break;
+    }
+
+    mask |= (unsigned) pass << index;
+  }
+
+  return mask;
+#endif
+}
+
+/* Narrow candidates by one pair of snapshots, RAM starting at offset ram */
+static void filter_pair(uint64_t* candidates, const uint8_t* before, const uint8_t* after,
+    size_t ram, enum search_filter filter, uint8_t value)
+{
+  for (int index = 0; index < SEARCH_BYTES; index += 16)
+  {
+    uint64_t* word = &candidates[index / 64];
+    int shift = index % 64;
+
+    /* Bytes already ruled out are not compared again */
+    if (!((*word >> shift) & 0xFFFF))
+    {
+      continue;
+    }
+
+    size_t offset = ram + SEARCH_ADDRESS(index);
+    uint64_t mask = filter_mask(before + offset, after + offset, filter, value);
+    *word &= ~((uint64_t) 0xFFFF << shift) | (mask << shift);
+  }
+}
+
+struct search_job
+{
+  uint64_t candidates[SEARCH_BYTES / 64];
+  const uint8_t* before;
+  const uint8_t* after;
+  size_t stride;
+  size_t ram;
+  int first;
+  int last;
+  enum search_filter filter;
+  uint8_t value;
+};
+
+static void* search_job(void* argument)
+{
+  struct search_job* job = argument;
+
+  for (int pair = job->first; pair < job->last; pair++)
+  {
+    filter_pair(job->candidates, job->before + pair * job->stride,
+        job->after + pair * job->stride, job->ram, job->filter, job->value);
+  }
+
+  return NULL;
+}
+
+/* Every byte starts out a candidate */
+void search_reset(struct ram_search* search)
+{
+  memset(search->candidates, 0xFF, sizeof(search->candidates));
+}
+
+/* Keep the candidates that pass the filter in every one of count pairs of
+ * snapshots, pair n being before and after plus n times stride. Pass
+ * consecutive frames as after = before + stride, or two vector_save_all
+ * buffers to filter across instances. search_equal compares the after byte
+ * with value, search_delta the change. The pairs are split over up to one
+ * thread per core. */
+void search_filter(struct ram_search* search, const uint8_t* before, const uint8_t* after,
+    size_t stride, int count, enum search_filter filter, uint8_t value)
+{
+  struct search_job jobs[SEARCH_THREADS];
+  pthread_t threads[SEARCH_THREADS];
+  int started[SEARCH_THREADS] = {0};
+  int threads_used = get_nprocs();
+  size_t ram = state_offset(&memory);
+
+  threads_used = threads_used < count / SEARCH_BATCH ? threads_used : count / SEARCH_BATCH;
+  threads_used = threads_used < 1 ? 1 : threads_used > SEARCH_THREADS ? SEARCH_THREADS : threads_used;
+
+  for (int index = 0; index < threads_used; index++)
+  {
+    struct search_job* job = &jobs[index];
+    memcpy(job->candidates, search->candidates, sizeof(job->candidates));
+    job->before = before;
+    job->after = after;
+    job->stride = stride;
+    job->ram = ram;
+    job->first = index * count / threads_used;
+    job->last = (index + 1) * count / threads_used;
+    job->filter = filter;
+    job->value = value;
+
+    if (index)
+    {
+      started[index] = !pthread_create(&threads[index], NULL, search_job, job);
+    }
+  }
+
+  search_job(&jobs[0]);
+  memcpy(search->candidates, jobs[0].candidates, sizeof(search->candidates));
+
+  /* A slice whose thread could not be started runs here instead */
+  for (int index = 1; index < threads_used; index++)
+  {
+    if (started[index])
+    {
+      pthread_join(threads[index], NULL);
+    }
+    else
+    {
+      search_job(&jobs[index]);
+    }
+
+    for (int word = 0; word < SEARCH_BYTES / 64; word++)
+    {
+      search->candidates[word] &= jobs[index].candidates[word];
+    }
+  }
+}
+
+int search_count(const struct ram_search* search)
+{
+  int count = 0;
+
+  for (int word = 0; word < SEARCH_BYTES / 64; word++)
+  {
+    count += __builtin_popcountll(search->candidates[word]);
+  }
+
+  return count;
+}
+
+/* Write up to max_addresses candidate addresses in order, returning how
+ * many candidates there are */
+int search_results(const struct ram_search* search, uint16_t* addresses, int max_addresses)
+{
+  int count = 0;
+
+  for (int word = 0; word < SEARCH_BYTES / 64; word++)
+  {
+    for (uint64_t bits = search->candidates[word]; bits; bits &= bits - 1)
+    {
+      if (count < max_addresses)
+      {
+        addresses[count] = SEARCH_ADDRESS(word * 64 + __builtin_ctzll(bits));
+      }
+      count++;
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,35 @@
+#ifndef C_SEARCH_H
+#define C_SEARCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* RAM search. A bitset of candidate bytes over the 2KB of RAM and the 8KB
+ * of PRG-RAM at $6000 is narrowed by filters applied to pairs of
+ * snapshots, until only the address holding the score or lives is left. */
+#define SEARCH_RAM_SIZE 0x800
+#define SEARCH_PRG_RAM 0x6000
+#define SEARCH_PRG_RAM_SIZE 0x2000
+#define SEARCH_BYTES (SEARCH_RAM_SIZE + SEARCH_PRG_RAM_SIZE)
+
+/* Pairs each thread takes at least, and the most threads used */
+#define SEARCH_BATCH 256
+#define SEARCH_THREADS 64
+
+enum search_filter {
+  search_increased, search_decreased, search_changed, search_unchanged,
+  search_equal, search_delta
+};
+
+struct ram_search
+{
+  uint64_t candidates[SEARCH_BYTES / 64];
+};
+
+void search_reset(struct ram_search* search);
+void search_filter(struct ram_search* search, const uint8_t* before, const uint8_t* after,
+    size_t stride, int count, enum search_filter filter, uint8_t value);
+int search_count(const struct ram_search* search);
+int search_results(const struct ram_search* search, uint16_t* addresses, int max_addresses);
+
+#endif
@@ -0,0 +1,194 @@
+#include "state.h"
+#include "cpu.h"
+#include <string.h>
+
+extern const struct state_chunk cpu_state[];
+extern const struct state_chunk scheduler_state[];
+extern const struct state_chunk dma_state[];
+extern const struct state_chunk ppu_state[];
+extern const struct state_chunk region_state[];
+extern const struct state_chunk input_state[];
+extern const struct state_chunk cartridge_state[];
+extern const struct state_chunk mmc3_state[];
+extern const struct state_chunk mmc5_state[];
+extern const struct state_chunk vrc_state[];
+extern const struct state_chunk sunsoft_state[];
+extern const struct state_chunk namco163_state[];
+extern const struct state_chunk cheat_state[];
+extern const struct state_chunk hook_state[];
+
+static const struct state_chunk* const modules[] = {
+  cpu_state, scheduler_state, dma_state, ppu_state, region_state, input_state,
+  cartridge_state, mmc3_state, mmc5_state, vrc_state, sunsoft_state, namco163_state,
+  cheat_state,
+#ifdef HOOKS
+  hook_state
+#endif
+};
+
+#define MODULES (sizeof(modules) / sizeof(modules[0]))
+
+static void* chunk_data(const struct state_chunk* chunk)
+{
+  return (chunk->flags & STATE_INDIRECT) ? *(void**) chunk->data : chunk->data;
+}
+
+/* Bytes taken by the chunks with any of flags set */
+size_t state_size(int flags)
+{
+  size_t size = 0;
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      size += (chunk->flags & flags) ? chunk->size : 0;
+    }
+  }
+
+  return size;
+}
+
+/* Where a global sits in a snapshot. For STATE_INDIRECT chunks pass the
+ * pointer's address, &memory gives where RAM starts. */
+size_t state_offset(const void* data)
+{
+  size_t offset = 0;
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & STATE_SNAPSHOT)
+      {
+        if (chunk->data == data)
+        {
+          return offset;
+        }
+        offset += chunk->size;
+      }
+    }
+  }
+
+  return offset;
+}
+
+void state_save(uint8_t* buffer, int flags)
+{
+  if (flags & STATE_SNAPSHOT)
+  {
+    METRICS_ADD(metric_state_bytes, state_size(flags));
+  }
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & flags)
+      {
+        memcpy(buffer, chunk_data(chunk), chunk->size);
+        buffer += chunk->size;
+      }
+    }
+  }
+}
+
+void state_load(const uint8_t* buffer, int flags)
+{
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & flags)
+      {
+        memcpy(chunk_data(chunk), buffer, chunk->size);
+        buffer += chunk->size;
+      }
+    }
+  }
+
+  if (flags & STATE_SNAPSHOT)
+  {
+    state_restore();
+  }
+}
+
+/* Snapshots name the region and the mapped banks rather than pointing at
+ * them, so they load into any instance of the same ROM. Rebuild the
+ * pointers for the instance in the globals. */
+void state_restore()
+{
+  restore_timing();
+  restore_banks();
+}
+
+/* Where a chunk's bytes sit within a context */
+static size_t context_offset(const void* data)
+{
+  size_t offset = 0;
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & STATE_CONTEXT)
+      {
+        if (chunk->data == data)
+        {
+          return offset;
+        }
+        offset += chunk->size;
+      }
+    }
+  }
+
+  return offset;
+}
+
+/* Bytes of a snapshot chunk within a parked context, following the pointer
+ * the context holds for STATE_INDIRECT chunks */
+static uint8_t* parked_data(uint8_t* context, const struct state_chunk* chunk, size_t offset)
+{
+  return (chunk->flags & STATE_INDIRECT) ? *(uint8_t**) (context + context_offset(chunk->data)) :
+    context + offset;
+}
+
+/* state_save for an instance parked in a context rather than in the
+ * globals. Different contexts can be saved from at the same time. */
+void state_save_parked(const uint8_t* context, uint8_t* buffer)
+{
+  size_t offset = 0;
+  METRICS_ADD(metric_state_bytes, state_size(STATE_SNAPSHOT));
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & STATE_SNAPSHOT)
+      {
+        memcpy(buffer, parked_data((uint8_t*) context, chunk, offset), chunk->size);
+        buffer += chunk->size;
+      }
+      offset += (chunk->flags & STATE_CONTEXT) ? chunk->size : 0;
+    }
+  }
+}
+
+/* The instance still needs state_restore once it is swapped in */
+void state_load_parked(uint8_t* context, const uint8_t* buffer)
+{
+  size_t offset = 0;
+
+  for (size_t module = 0; module < MODULES; module++)
+  {
+    for (const struct state_chunk* chunk = modules[module]; chunk->data; chunk++)
+    {
+      if (chunk->flags & STATE_SNAPSHOT)
+      {
+        memcpy(parked_data(context, chunk, offset), buffer, chunk->size);
+        buffer += chunk->size;
+      }
+      offset += (chunk->flags & STATE_CONTEXT) ? chunk->size : 0;
+    }
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef C_STATE_H
+#define C_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Per-instance state. Every module lists its mutable variables as chunks,
+ * so the whole machine can be swapped between instances or saved as a
+ * snapshot without knowing what each module keeps. */
+#define STATE_CONTEXT 0x01
+#define STATE_SNAPSHOT 0x02
+#define STATE_INDIRECT 0x04
+#define STATE_ALL (STATE_CONTEXT | STATE_SNAPSHOT)
+#define STATE_END {NULL, 0, 0}
+
+/* The part of memory a snapshot keeps: RAM, registers and PRG-RAM */
+#define STATE_MEMORY_SIZE 0x8000
+
+/* STATE_CONTEXT chunks are swapped when switching instances, STATE_SNAPSHOT
+ * chunks are saved in snapshots. STATE_INDIRECT chunks point at a pointer
+ * to the bytes, which must itself be a STATE_CONTEXT chunk. Every other
+ * snapshot chunk is also in the context, so a parked instance can be saved
+ * without swapping it in. */
+struct state_chunk
+{
+  void* data;
+  size_t size;
+  int flags;
+};
+
+size_t state_size(int flags);
+size_t state_offset(const void* data);
+void state_save(uint8_t* buffer, int flags);
+void state_load(const uint8_t* buffer, int flags);
+void state_restore();
+void state_save_parked(const uint8_t* context, uint8_t* buffer);
+void state_load_parked(uint8_t* context, const uint8_t* buffer);
+
+#endif
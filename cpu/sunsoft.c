@@ -0,0 +1,189 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+
+/* Sunsoft FME-7 (mapper 69), with the 5B's three tone channels. The 5B
+ * noise generator and envelope are not emulated. */
+
+/* 5B volume steps are 3dB apart */
+static const int volumes[16] = {
+  0, 2, 3, 4, 6, 8, 11, 16, 23, 32, 45, 64, 90, 128, 181, 255
+};
+
+static struct
+{
+  uint8_t command;
+  uint8_t irq_control;
+  uint16_t counter;
+  long long sync_clock;
+  uint8_t audio_select;
+  uint8_t audio_registers[16];
+  int tone_timers[3];
+  uint8_t tone_phases[3];
+  long long audio_clock;
+} fme7;
+
+const struct state_chunk sunsoft_state[] = {
+  {&fme7, sizeof(fme7), STATE_ALL},
+  STATE_END
+};
+
+static void catch_up()
+{
+  /* The counter only runs while bit 7 of the IRQ control is set */
+  if (fme7.irq_control & 0x80)
+  {
+    fme7.counter -= system_clock(cycles) - fme7.sync_clock;
+  }
+
+  fme7.sync_clock = system_clock(cycles);
+}
+
+static void irq_event();
+
+/* The IRQ fires when the counter wraps from $0000 to $FFFF */
+static void predict()
+{
+  if ((fme7.irq_control & 0x81) == 0x81)
+  {
+    schedule_event(clock_cycle(system_clock(cycles) + fme7.counter + 1), irq_event);
+  }
+  else
+  {
+    cancel_event(irq_event);
+  }
+}
+
+static void irq_event()
+{
+  catch_up();
+  set_irq(1);
+  predict();
+}
+
+static int tone_period(int channel)
+{
+  int period = fme7.audio_registers[channel * 2] |
+    ((fme7.audio_registers[channel * 2 + 1] & 0x0F) << 8);
+  return (period ? period : 1) * 16;
+}
+
+static void audio_catch_up()
+{
+  int elapsed = system_clock(cycles) - fme7.audio_clock;
+  fme7.audio_clock = system_clock(cycles);
+
+  for (int channel = 0; channel < 3 && elapsed > 0; channel++)
+  {
+    int* timer = &fme7.tone_timers[channel];
+    int period = tone_period(channel);
+
+    if (elapsed < *timer)
+    {
+      *timer -= elapsed;
+      continue;
+    }
+
+    int remaining = elapsed - *timer;
+    fme7.tone_phases[channel] ^= (1 + remaining / period) & 1;
+    *timer = period - remaining % period;
+  }
+}
+
+/* Current output level, 0 to 765. A disabled tone holds its volume. */
+static int fme7_audio()
+{
+  int level = 0;
+
+  audio_catch_up();
+
+  for (int channel = 0; channel < 3; channel++)
+  {
+    int disabled = fme7.audio_registers[7] & (1 << channel);
+
+    if (disabled || fme7.tone_phases[channel])
+    {
+      level += volumes[fme7.audio_registers[8 + channel] & 0x0F];
+    }
+  }
+
+  return level;
+}
+
+static void map_low(uint8_t data)
+{
+  if (data & 0x40)
+  {
+    /* PRG-RAM, which lives in the flat memory */
+    map_prg_ram(-1);
+  }
+  else
+  {
+    map_prg(-1, data & 0x3F);
+  }
+}
+
+static void fme7_write(uint16_t address, uint8_t data)
+{
+  switch (address & 0xE000) {
+    case 0x8000:
+      fme7.command = data & 0x0F;
+      break;
+    case 0xA000:
+      switch (fme7.command) {
+        case 0x8:
+          map_low(data);
+          break;
+        case 0x9:
+        case 0xA:
+        case 0xB:
+          map_prg(fme7.command - 0x9, data & 0x3F);
+          break;
+        case 0xC:
+          cartridge.vertical_mirroring = !(data & 0x03);
+          break;
+        case 0xD:
+          catch_up();
+          fme7.irq_control = data;
+          set_irq(0);
+          predict();
+          break;
+        case 0xE:
+          catch_up();
+          fme7.counter = (fme7.counter & 0xFF00) | data;
+          predict();
+          break;
+        case 0xF:
+          catch_up();
+          fme7.counter = (fme7.counter & 0x00FF) | (data << 8);
+          predict();
+          break;
+        default:
+          map_chr(fme7.command, data);
+          break;
+      }
+      break;
+    case 0xC000:
+      fme7.audio_select = data & 0x0F;
+      break;
+    case 0xE000:
+      audio_catch_up();
+      fme7.audio_registers[fme7.audio_select] = data;
+      break;
+  }
+}
+
+void fme7_init()
+{
+  memset(&fme7, 0, sizeof(fme7));
+  fme7.sync_clock = system_clock(cycles);
+  fme7.audio_clock = system_clock(cycles);
+  fme7.tone_timers[0] = fme7.tone_timers[1] = fme7.tone_timers[2] = 16;
+  mapper_write = fme7_write;
+  mapper_irq = irq_event;
+  mapper_audio = fme7_audio;
+  map_prg(0, 0);
+  map_prg(1, 1);
+  map_prg(2, 2);
+  map_prg(3, -1);
+}
@@ -0,0 +1,17 @@
+#ifndef C_TABLES_H
+#define C_TABLES_H
+
+#include <stdint.h>
+
+/* Lookup tables generated by table_generator.py at build time. They are
+ * const so they live in read-only data shared by every process. */
+extern const uint8_t nz_flags[256];
+extern const uint8_t nzc_flags[512];
+extern const uint8_t overflow_flags[8];
+extern const uint16_t chr_interleave[256];
+extern const uint32_t palette_rgb[64];
+extern const uint32_t crc32_tables[8 * 256];
+
+#define OVERFLOW_INDEX(a, m, r) ((((a) & 0x80) >> 5) | (((m) & 0x80) >> 6) | (((r) & 0x80) >> 7))
+
+#endif
@@ -0,0 +1,84 @@
+#include "trace.h"
+#include "cpu.h"
+#include <stdatomic.h>
+#include <time.h>
+
+static const char* span_names[] = {"cpu", "ppu", "apu", "dma", "interrupt"};
+
+static _Atomic(struct trace_buffer*) buffers;
+static atomic_int thread_count;
+static __thread struct trace_buffer* buffer;
+
+/* First event on a thread allocates its buffer and pushes it on the list */
+static struct trace_buffer* thread_buffer()
+{
+  struct trace_buffer* head;
+
+  buffer = calloc(1, sizeof(struct trace_buffer));
+  buffer->thread = atomic_fetch_add(&thread_count, 1);
+  head = atomic_load(&buffers);
+
+  do
+  {
+    buffer->next = head;
+  } while (!atomic_compare_exchange_weak(&buffers, &head, buffer));
+
+  return buffer;
+}
+
+void trace_record(enum trace_span span, int begin)
+{
+  struct trace_buffer* local = buffer ? buffer : thread_buffer();
+  struct timespec now;
+
+  if (local->count == TRACE_BUFFER_SIZE)
+  {
+    local->dropped++;
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  struct trace_event* event = &local->events[local->count++];
+  event->host_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  event->cycle = cycles;
+  event->span = span;
+  event->begin = begin;
+}
+
+/* Write every buffer as one trace and empty them. Only call this once the
+ * recording threads are done. */
+int trace_flush(FILE* file)
+{
+  int first = 1;
+
+  fprintf(file, "{\"traceEvents\":[");
+
+  for (struct trace_buffer* local = atomic_load(&buffers); local; local = local->next)
+  {
+    for (int index = 0; index < local->count; index++)
+    {
+      struct trace_event* event = &local->events[index];
+      fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+        "\"pid\":0,\"tid\":%d,\"args\":{\"cycle\":%lld}}",
+        first ? "" : ",", span_names[event->span], event->begin ? 'B' : 'E',
+        (unsigned long long) (event->host_ns / 1000),
+        (unsigned) (event->host_ns % 1000), local->thread, event->cycle);
+      first = 0;
+    }
+
+    if (local->dropped)
+    {
+      fprintf(file, "%s\n{\"name\":\"dropped\",\"ph\":\"C\",\"ts\":0,"
+        "\"pid\":0,\"tid\":%d,\"args\":{\"events\":%d}}",
+        first ? "" : ",", local->thread, local->dropped);
+      first = 0;
+    }
+
+    local->count = 0;
+    local->dropped = 0;
+  }
+
+  fprintf(file, "\n]}\n");
+  return ferror(file) ? -1 : 0;
+}
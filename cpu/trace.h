@@ -0,0 +1,42 @@
+#ifndef C_TRACE_H
+#define C_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Timeline of emulator spans written as Chrome trace-event JSON, which
+ * chrome://tracing and Perfetto both open. Every thread records into its
+ * own buffer, buffers are only walked by trace_flush at the end of a run. */
+#define TRACE_BUFFER_SIZE 65536
+
+enum trace_span {trace_cpu, trace_ppu, trace_apu, trace_dma, trace_interrupt};
+
+struct trace_event
+{
+  uint64_t host_ns;
+  long long cycle;
+  uint8_t span;
+  uint8_t begin;
+};
+
+struct trace_buffer
+{
+  struct trace_buffer* next;
+  int thread;
+  int count;
+  int dropped;
+  struct trace_event events[TRACE_BUFFER_SIZE];
+};
+
+void trace_record(enum trace_span span, int begin);
+int trace_flush(FILE* file);
+
+#ifdef TRACE
+#define TRACE_BEGIN(span) ({ trace_record(span, 1); })
+#define TRACE_END(span) ({ trace_record(span, 0); })
+#else
+#define TRACE_BEGIN(span)
+#define TRACE_END(span)
+#endif
+
+#endif
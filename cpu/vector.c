@@ -0,0 +1,482 @@
+#include "vector.h"
+#include "cpu.h"
+#include <string.h>
+#include <sys/sysinfo.h>
+
+#define CONTEXT(vector, env) ((vector)->contexts + (size_t) (env) * (vector)->context_size)
+#define RECORD(vector, buffer, env) ((buffer) + (size_t) (env) * (vector)->snapshot_size)
+#define BOOT(vector, env) ((vector)->boots + (size_t) (env) * (vector)->snapshot_size)
+
+/* Held while an instance of any vector is in the globals */
+static pthread_mutex_t emulation_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Boot count instances of an iNES image, all sharing one cached copy of
+ * the ROM. The globals are handed over to the instances. NULL when the ROM
+ * does not load. */
+struct vector* vector_create(int count, const uint8_t* rom, size_t size, int boot_frames)
+{
+  struct rom_image* image = malloc(sizeof(struct rom_image) + size);
+  image->crc = rom_crc32(0, rom, size);
+  image->size = size;
+  memcpy(image->data, rom, size);
+  image = rom_cache_insert(image);
+
+  struct vector* vector = calloc(1, sizeof(struct vector));
+  vector->count = count;
+  vector->context_size = state_size(STATE_CONTEXT);
+  vector->snapshot_size = state_size(STATE_SNAPSHOT);
+  vector->contexts = malloc(count * vector->context_size);
+  vector->boots = malloc(count * vector->snapshot_size);
+  vector->pending.envs = malloc(count * sizeof(int));
+  vector->finished.envs = malloc(count * sizeof(int));
+  vector->stuck = calloc(count, 1);
+  vector->stalls = calloc(count, sizeof(int));
+  vector->stall_pcs = calloc(count, sizeof(uint16_t));
+  vector->restored = calloc(count, 1);
+  vector->busy = calloc(count, 1);
+  vector->actions = malloc(count);
+  vector->repeats = malloc(count * sizeof(int));
+  vector->results = malloc(count * sizeof(struct vector_result));
+  pthread_mutex_init(&vector->lock, NULL);
+  pthread_cond_init(&vector->submitted, NULL);
+  pthread_cond_init(&vector->completed, NULL);
+
+  pthread_mutex_lock(&emulation_lock);
+  for (int env = 0; env < count; env++)
+  {
+    /* The previous instance keeps its cartridge */
+    memset(&cartridge, 0, sizeof(cartridge));
+    initialize_cpu();
+    if (load_image(rom_cache_acquire(image->crc, image->size)))
+    {
+      deinitialize_cpu();
+      pthread_mutex_unlock(&emulation_lock);
+      vector->count = env;
+      vector_destroy(vector);
+      rom_cache_release(image);
+      return NULL;
+    }
+
+    pc = ADDR_16(RESET_VECTOR);
+    for (int frame = 0; frame < boot_frames; frame++)
+    {
+      run_frame();
+    }
+
+    state_save(BOOT(vector, env), STATE_SNAPSHOT);
+    state_save(CONTEXT(vector, env), STATE_CONTEXT);
+  }
+  pthread_mutex_unlock(&emulation_lock);
+
+  rom_cache_release(image);
+  return vector;
+}
+
+void vector_destroy(struct vector* vector)
+{
+  if (vector->started)
+  {
+    pthread_mutex_lock(&vector->lock);
+    vector->stopping = 1;
+    pthread_cond_signal(&vector->submitted);
+    pthread_mutex_unlock(&vector->lock);
+    pthread_join(vector->worker, NULL);
+  }
+
+  pthread_mutex_lock(&emulation_lock);
+  for (int env = 0; env < vector->count; env++)
+  {
+    state_load(CONTEXT(vector, env), STATE_CONTEXT);
+    deinitialize_cpu();
+  }
+  pthread_mutex_unlock(&emulation_lock);
+
+  free(vector->contexts);
+  free(vector->boots);
+  free(vector->pending.envs);
+  free(vector->finished.envs);
+  free(vector->stuck);
+  free(vector->stalls);
+  free(vector->stall_pcs);
+  free(vector->restored);
+  free(vector->busy);
+  free(vector->actions);
+  free(vector->repeats);
+  free(vector->results);
+  pthread_mutex_destroy(&vector->lock);
+  pthread_cond_destroy(&vector->submitted);
+  pthread_cond_destroy(&vector->completed);
+  free(vector);
+}
+
+int vector_add_reward(struct vector* vector, struct reward_term term)
+{
+  if (vector->reward_count == VECTOR_MAX_TERMS)
+  {
+    return -1;
+  }
+
+  vector->rewards[vector->reward_count++] = term;
+  return 0;
+}
+
+int vector_add_done(struct vector* vector, struct done_term term)
+{
+  if (vector->done_count == VECTOR_MAX_TERMS)
+  {
+    return -1;
+  }
+
+  vector->dones[vector->done_count++] = term;
+  return 0;
+}
+
+/* Park instance from and bring instance to into the globals. -1 for either
+ * side skips it. Bringing one in from -1 takes the emulation lock and
+ * parking one to -1 releases it, so other threads, and other vectors'
+ * workers, wait while an instance is in the globals. */
+void vector_switch(struct vector* vector, int from, int to)
+{
+  if (from >= 0)
+  {
+    state_save(CONTEXT(vector, from), STATE_CONTEXT);
+  }
+  else if (to >= 0)
+  {
+    pthread_mutex_lock(&emulation_lock);
+  }
+
+  if (to >= 0)
+  {
+    state_load(CONTEXT(vector, to), STATE_CONTEXT);
+    if (vector->restored[to])
+    {
+      state_restore();
+      vector->restored[to] = 0;
+    }
+  }
+  else if (from >= 0)
+  {
+    pthread_mutex_unlock(&emulation_lock);
+  }
+}
+
+/* Run one frame, or up to skip_lag frames until the game polls input, and
+ * score it. Returns 1 when the episode ended. */
+static int step_frame(struct vector* vector, float* reward)
+{
+  uint8_t before[VECTOR_MAX_TERMS];
+  for (int term = 0; term < vector->reward_count; term++)
+  {
+    before[term] = memory[vector->rewards[term].address];
+  }
+
+  if (vector->skip_lag)
+  {
+    run_input_frame(vector->skip_lag);
+  }
+  else
+  {
+    run_frame();
+  }
+
+  for (int term = 0; term < vector->reward_count; term++)
+  {
+    const struct reward_term* r = &vector->rewards[term];
+    uint8_t now = memory[r->address];
+    *reward += r->kind == reward_delta ? r->scale * (int8_t) (now - before[term]) : now == r->value ? r->scale : 0;
+  }
+
+  for (int term = 0; term < vector->done_count; term++)
+  {
+    const struct done_term* d = &vector->dones[term];
+    if ((memory[d->address] & d->mask) == d->value)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Count a frame toward the watchdog, 1 once the instance has gone
+ * stall_frames frames without progress. A guest stuck in a loop with
+ * interrupts off takes no NMI, polls nothing and stays where it was. */
+static int stalled(struct vector* vector, int env, long long nmis)
+{
+  if (nmi_count != nmis || !input_last.lag || abs(pc - vector->stall_pcs[env]) > VECTOR_STALL_WINDOW)
+  {
+    vector->stalls[env] = 0;
+    vector->stall_pcs[env] = pc;
+    return 0;
+  }
+
+  return vector->stall_frames && ++vector->stalls[env] >= vector->stall_frames;
+}
+
+/* Run one instance for repeat frames with the action held. The watchdog
+ * looks at it between frames, so a jam or a hang costs at most the frame
+ * it was noticed in. */
+static void step_env(struct vector* vector, int env, uint8_t action, int repeat,
+    struct vector_result* result)
+{
+  int done = 0;
+  result->reward = 0;
+
+  vector_switch(vector, -1, env);
+  input_buttons[0] = action;
+  int stuck = jammed;
+
+  for (int frame = 0; frame < repeat && !done && !stuck; frame++)
+  {
+    long long nmis = nmi_count;
+    done = step_frame(vector, &result->reward);
+    stuck = jammed || stalled(vector, env, nmis);
+  }
+
+  result->done = done;
+  result->stuck = stuck;
+  result->frame = input_last;
+  vector->stuck[env] = stuck;
+
+  if (done || (stuck && vector->reset_stuck))
+  {
+    state_load(BOOT(vector, env), STATE_SNAPSHOT);
+    vector->stalls[env] = 0;
+  }
+
+  vector_switch(vector, env, -1);
+}
+
+/* Apply actions[env] to controller 1 of every instance for repeat frames.
+ * Rewards are summed over the frames, an instance whose episode ends stops
+ * early, reports done and is reset to its boot snapshot. frames receives
+ * the input accounting of each instance's last frame and may be NULL. The
+ * watchdog's verdicts are left in stuck. Not to be mixed with asynchronous
+ * steps in flight. */
+void vector_step(struct vector* vector, const uint8_t* actions, int repeat, float* rewards,
+    uint8_t* dones, struct input_frame* frames)
+{
+  for (int env = 0; env < vector->count; env++)
+  {
+    struct vector_result result;
+    step_env(vector, env, actions[env], repeat, &result);
+
+    rewards[env] = result.reward;
+    dones[env] = result.done;
+    if (frames)
+    {
+      frames[env] = result.frame;
+    }
+  }
+}
+
+/* The queues hold at most one entry per instance */
+static void queue_push(struct vector* vector, struct vector_queue* queue, int env)
+{
+  queue->envs[(queue->head + queue->length++) % vector->count] = env;
+}
+
+static int queue_pop(struct vector* vector, struct vector_queue* queue)
+{
+  int env = queue->envs[queue->head];
+  queue->head = (queue->head + 1) % vector->count;
+  queue->length--;
+  return env;
+}
+
+static void* worker(void* argument)
+{
+  struct vector* vector = argument;
+
+  pthread_mutex_lock(&vector->lock);
+  while (1)
+  {
+    while (!vector->pending.length && !vector->stopping)
+    {
+      pthread_cond_wait(&vector->submitted, &vector->lock);
+    }
+    if (vector->stopping)
+    {
+      break;
+    }
+
+    int env = queue_pop(vector, &vector->pending);
+    pthread_mutex_unlock(&vector->lock);
+
+    step_env(vector, env, vector->actions[env], vector->repeats[env], &vector->results[env]);
+
+    pthread_mutex_lock(&vector->lock);
+    queue_push(vector, &vector->finished, env);
+    pthread_cond_signal(&vector->completed);
+  }
+  pthread_mutex_unlock(&vector->lock);
+
+  return NULL;
+}
+
+/* Queue a step of each listed instance and return at once. Instances run
+ * in the order given and vector_wait hands them back as they finish, so
+ * results for the first can be used while the rest still emulate. -1 when
+ * an id is out of range or listed twice, an instance already has a step in
+ * flight or the worker does not start, nothing is queued then. */
+int vector_step_async(struct vector* vector, const int* envs, const uint8_t* actions, int count,
+    int repeat)
+{
+  int claimed = 0;
+
+  pthread_mutex_lock(&vector->lock);
+
+  /* Instances are marked busy as they are checked, which also catches an
+   * id repeated within the call */
+  for (; claimed < count; claimed++)
+  {
+    int env = envs[claimed];
+    if (env < 0 || env >= vector->count || vector->busy[env])
+    {
+      break;
+    }
+    vector->busy[env] = 1;
+  }
+
+  if (claimed == count && !vector->started)
+  {
+    vector->started = pthread_create(&vector->worker, NULL, worker, vector) == 0;
+  }
+
+  if (claimed < count || !vector->started)
+  {
+    while (claimed--)
+    {
+      vector->busy[envs[claimed]] = 0;
+    }
+    pthread_mutex_unlock(&vector->lock);
+    return -1;
+  }
+
+  for (int index = 0; index < count; index++)
+  {
+    int env = envs[index];
+    vector->actions[env] = actions[index];
+    vector->repeats[env] = repeat;
+    queue_push(vector, &vector->pending, env);
+  }
+  vector->in_flight += count;
+
+  pthread_cond_signal(&vector->submitted);
+  pthread_mutex_unlock(&vector->lock);
+  return 0;
+}
+
+/* Block until a queued step finishes and return its instance, whose
+ * outcome is in results[env]. -1 when no steps are in flight. */
+int vector_wait(struct vector* vector)
+{
+  int env = -1;
+
+  pthread_mutex_lock(&vector->lock);
+  if (vector->in_flight)
+  {
+    while (!vector->finished.length)
+    {
+      pthread_cond_wait(&vector->completed, &vector->lock);
+    }
+
+    env = queue_pop(vector, &vector->finished);
+    vector->busy[env] = 0;
+    vector->in_flight--;
+  }
+  pthread_mutex_unlock(&vector->lock);
+
+  return env;
+}
+
+/* A range of instances saved or restored by one thread */
+struct state_job
+{
+  struct vector* vector;
+  uint8_t* buffer;
+  int first;
+  int last;
+  int restore;
+};
+
+static void* state_job(void* argument)
+{
+  struct state_job* job = argument;
+  struct vector* vector = job->vector;
+
+  for (int env = job->first; env < job->last; env++)
+  {
+    if (job->restore)
+    {
+      state_load_parked(CONTEXT(vector, env), RECORD(vector, job->buffer, env));
+      vector->restored[env] = 1;
+      vector->stalls[env] = 0;
+    }
+    else
+    {
+      state_save_parked(CONTEXT(vector, env), RECORD(vector, job->buffer, env));
+    }
+  }
+
+  return NULL;
+}
+
+/* Split the instances over up to one thread per core, each taking at least
+ * VECTOR_STATE_BATCH of them. The calling thread takes the first range. */
+static void state_all(struct vector* vector, uint8_t* buffer, int restore)
+{
+  struct state_job jobs[VECTOR_STATE_THREADS];
+  pthread_t threads[VECTOR_STATE_THREADS];
+  int started[VECTOR_STATE_THREADS] = {0};
+  int count = get_nprocs();
+
+  count = count < vector->count / VECTOR_STATE_BATCH ? count : vector->count / VECTOR_STATE_BATCH;
+  count = count < 1 ? 1 : count > VECTOR_STATE_THREADS ? VECTOR_STATE_THREADS : count;
+
+  for (int index = 0; index < count; index++)
+  {
+    jobs[index] = (struct state_job) {vector, buffer, index * vector->count / count,
+      (index + 1) * vector->count / count, restore};
+    if (index)
+    {
+      started[index] = !pthread_create(&threads[index], NULL, state_job, &jobs[index]);
+    }
+  }
+
+  state_job(&jobs[0]);
+
+  /* A range whose thread could not be started runs here instead */
+  for (int index = 1; index < count; index++)
+  {
+    if (started[index])
+    {
+      pthread_join(threads[index], NULL);
+    }
+    else
+    {
+      state_job(&jobs[index]);
+    }
+  }
+}
+
+/* Bytes vector_save_all writes, one record of snapshot_size per instance */
+size_t vector_state_size(struct vector* vector)
+{
+  return vector->count * vector->snapshot_size;
+}
+
+/* Write every instance's snapshot to buffer, instance env at env times
+ * snapshot_size. Records hold no pointers, so they restore into any
+ * instance of the same ROM, in this vector or another. Not while steps are
+ * in flight. */
+void vector_save_all(struct vector* vector, uint8_t* buffer)
+{
+  state_all(vector, buffer, 0);
+}
+
+void vector_restore_all(struct vector* vector, const uint8_t* buffer)
+{
+  state_all(vector, (uint8_t*) buffer, 1);
+}
@@ -0,0 +1,120 @@
+#ifndef C_VECTOR_H
+#define C_VECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "input.h"
+
+/* Many instances of the same ROM stepped together. Each instance keeps its
+ * machine in a context that is swapped into the globals while it runs, and
+ * a snapshot taken after boot to reset from when its episode ends. The
+ * globals are shared by every vector in the process, so one lock is held
+ * from swapping an instance in until it is parked again. */
+#define VECTOR_MAX_TERMS 8
+
+/* How far the program counter may wander between frames and still count
+ * as the same loop for the watchdog */
+#define VECTOR_STALL_WINDOW 16
+
+/* vector_save_all and vector_restore_all give each thread at least
+ * VECTOR_STATE_BATCH instances, on at most VECTOR_STATE_THREADS threads */
+#define VECTOR_STATE_BATCH 64
+#define VECTOR_STATE_THREADS 64
+
+enum reward_kind {reward_delta, reward_equal};
+
+/* reward_delta adds scale times the signed change of a RAM byte over the
+ * frame, reward_equal adds scale on frames ending with the byte at value */
+struct reward_term
+{
+  uint16_t address;
+  uint8_t kind;
+  uint8_t value;
+  float scale;
+};
+
+/* The episode ends on the first frame where (byte & mask) == value */
+struct done_term
+{
+  uint16_t address;
+  uint8_t mask;
+  uint8_t value;
+};
+
+/* What one step of one instance produced */
+struct vector_result
+{
+  float reward;
+  uint8_t done;
+  uint8_t stuck;
+  struct input_frame frame;
+};
+
+/* Instance ids waiting for the worker or for vector_wait */
+struct vector_queue
+{
+  int* envs;
+  int head;
+  int length;
+};
+
+struct vector
+{
+  int count;
+  /* Frames skipped while the game ignores input, 0 to step every frame */
+  int skip_lag;
+  /* Watchdog. An instance that jams, or goes stall_frames frames in a row
+   * without progress, 0 for no limit, is flagged in stuck and stops there.
+   * Progress is an NMI taken, a controller poll or the program counter
+   * leaving the VECTOR_STALL_WINDOW bytes it ended a frame in. With
+   * reset_stuck it goes back to its boot snapshot, otherwise a jammed
+   * instance is skipped until restored. */
+  int stall_frames;
+  int reset_stuck;
+  uint8_t* stuck;
+  int* stalls;
+  uint16_t* stall_pcs;
+  /* Instances restored while parked, rebuilt as they are next swapped in */
+  uint8_t* restored;
+  size_t context_size;
+  size_t snapshot_size;
+  uint8_t* contexts;
+  uint8_t* boots;
+  struct reward_term rewards[VECTOR_MAX_TERMS];
+  int reward_count;
+  struct done_term dones[VECTOR_MAX_TERMS];
+  int done_count;
+
+  /* Asynchronous steps. One worker emulates, since the instances take
+   * turns in the globals, while the caller gets on with other work. */
+  pthread_t worker;
+  int started;
+  int stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t submitted;
+  pthread_cond_t completed;
+  struct vector_queue pending;
+  struct vector_queue finished;
+  int in_flight;
+  uint8_t* busy;
+  uint8_t* actions;
+  int* repeats;
+  struct vector_result* results;
+};
+
+struct vector* vector_create(int count, const uint8_t* rom, size_t size, int boot_frames);
+void vector_destroy(struct vector* vector);
+int vector_add_reward(struct vector* vector, struct reward_term term);
+int vector_add_done(struct vector* vector, struct done_term term);
+void vector_switch(struct vector* vector, int from, int to);
+void vector_step(struct vector* vector, const uint8_t* actions, int repeat, float* rewards,
+    uint8_t* dones, struct input_frame* frames);
+int vector_step_async(struct vector* vector, const int* envs, const uint8_t* actions, int count,
+    int repeat);
+int vector_wait(struct vector* vector);
+size_t vector_state_size(struct vector* vector);
+void vector_save_all(struct vector* vector, uint8_t* buffer);
+void vector_restore_all(struct vector* vector, const uint8_t* buffer);
+
+#endif
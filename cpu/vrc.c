@@ -0,0 +1,387 @@
+#include "cartridge.h"
+#include "cpu.h"
+#include <string.h>
+
+/* Konami VRC6 (mappers 24 and 26) and VRC7 (mapper 85). Both share the VRC
+ * IRQ counter, which counts up from a latch either every CPU cycle or every
+ * scanline through a prescaler, and raises the IRQ when it overflows. */
+#define VRC_IRQ_ACK_ENABLE 0x01
+#define VRC_IRQ_ENABLE 0x02
+#define VRC_IRQ_CYCLE_MODE 0x04
+
+static struct
+{
+  uint8_t latch;
+  uint8_t counter;
+  uint8_t control;
+  int prescaler;
+  long long sync_clock;
+} vrc_irq;
+
+struct vrc6_pulse
+{
+  uint8_t volume;
+  uint8_t duty;
+  uint8_t constant;
+  uint16_t period;
+  int enabled;
+  int timer;
+  uint8_t step;
+};
+
+static struct
+{
+  struct vrc6_pulse pulse[2];
+  uint8_t saw_rate;
+  uint16_t saw_period;
+  int saw_enabled;
+  int saw_timer;
+  uint8_t saw_step;
+  long long sync_clock;
+} audio;
+
+static int swap_lines;
+
+const struct state_chunk vrc_state[] = {
+  {&vrc_irq, sizeof(vrc_irq), STATE_ALL},
+  {&audio, sizeof(audio), STATE_ALL},
+  {&swap_lines, sizeof(swap_lines), STATE_ALL},
+  STATE_END
+};
+
+/* Advance a divider of the given period by elapsed cycles, returning how many
+ * times it expired. The timer holds the cycles left until it next expires. */
+static int divide(int* timer, int period, int elapsed)
+{
+  if (elapsed < *timer)
+  {
+    *timer -= elapsed;
+    return 0;
+  }
+
+  elapsed -= *timer;
+  *timer = period - elapsed % period;
+  return 1 + elapsed / period;
+}
+
+/* IRQ counter */
+
+static void irq_catch_up()
+{
+  int elapsed = system_clock(cycles) - vrc_irq.sync_clock;
+  int clocks = 0;
+  vrc_irq.sync_clock = system_clock(cycles);
+
+  if (!(vrc_irq.control & VRC_IRQ_ENABLE) || elapsed <= 0)
+  {
+    return;
+  }
+
+  if (vrc_irq.control & VRC_IRQ_CYCLE_MODE)
+  {
+    clocks = elapsed;
+  }
+  else if (elapsed * 3 >= vrc_irq.prescaler)
+  {
+    /* The prescaler drops by 3 a cycle and reloads 341 on each clock */
+    clocks = (elapsed * 3 - vrc_irq.prescaler) / DOTS_PER_SCANLINE + 1;
+    vrc_irq.prescaler += clocks * DOTS_PER_SCANLINE - elapsed * 3;
+  }
+  else
+  {
+    vrc_irq.prescaler -= elapsed * 3;
+  }
+
+  if (vrc_irq.counter + clocks <= 0xFF)
+  {
+    vrc_irq.counter += clocks;
+  }
+  else
+  {
+    clocks -= 0x100 - vrc_irq.counter;
+    vrc_irq.counter = vrc_irq.latch + clocks % (0x100 - vrc_irq.latch);
+  }
+}
+
+static void irq_event();
+
+static void irq_predict()
+{
+  int clocks = 0x100 - vrc_irq.counter;
+  int delay;
+
+  if (!(vrc_irq.control & VRC_IRQ_ENABLE))
+  {
+    cancel_event(irq_event);
+    return;
+  }
+
+  if (vrc_irq.control & VRC_IRQ_CYCLE_MODE)
+  {
+    delay = clocks;
+  }
+  else
+  {
+    delay = (vrc_irq.prescaler + (clocks - 1) * DOTS_PER_SCANLINE + 2) / 3;
+  }
+
+  schedule_event(clock_cycle(system_clock(cycles) + delay), irq_event);
+}
+
+static void irq_event()
+{
+  irq_catch_up();
+  set_irq(1);
+  irq_predict();
+}
+
+static void irq_write(int reg, uint8_t data)
+{
+  irq_catch_up();
+
+  switch (reg) {
+    case 0:
+      vrc_irq.latch = data;
+      break;
+    case 1:
+      vrc_irq.control = data & 0x07;
+      set_irq(0);
+
+      if (vrc_irq.control & VRC_IRQ_ENABLE)
+      {
+        vrc_irq.counter = vrc_irq.latch;
+        vrc_irq.prescaler = DOTS_PER_SCANLINE;
+      }
+      break;
+    case 2:
+      set_irq(0);
+      vrc_irq.control = (vrc_irq.control & ~VRC_IRQ_ENABLE) |
+        ((vrc_irq.control & VRC_IRQ_ACK_ENABLE) << 1);
+      break;
+  }
+
+  irq_predict();
+}
+
+/* VRC6 audio: two pulse channels and a sawtooth, caught up on demand */
+
+static void audio_catch_up()
+{
+  int elapsed = system_clock(cycles) - audio.sync_clock;
+  audio.sync_clock = system_clock(cycles);
+
+  if (elapsed <= 0)
+  {
+    return;
+  }
+
+  for (int index = 0; index < 2; index++)
+  {
+    struct vrc6_pulse* pulse = &audio.pulse[index];
+
+    if (pulse->enabled)
+    {
+      pulse->step = (pulse->step - divide(&pulse->timer, pulse->period + 1, elapsed)) & 0x0F;
+    }
+  }
+
+  if (audio.saw_enabled)
+  {
+    audio.saw_step = (audio.saw_step + divide(&audio.saw_timer, audio.saw_period + 1, elapsed)) % 14;
+  }
+}
+
+/* Current output level, 0 to 61 */
+static int vrc6_audio()
+{
+  int level = 0;
+
+  audio_catch_up();
+
+  for (int index = 0; index < 2; index++)
+  {
+    struct vrc6_pulse* pulse = &audio.pulse[index];
+
+    if (pulse->enabled && (pulse->constant || pulse->step <= pulse->duty))
+    {
+      level += pulse->volume;
+    }
+  }
+
+  if (audio.saw_enabled)
+  {
+    level += ((audio.saw_rate * (audio.saw_step >> 1)) & 0xFF) >> 3;
+  }
+
+  return level;
+}
+
+static void vrc6_audio_write(int channel, int reg, uint8_t data)
+{
+  audio_catch_up();
+
+  if (channel < 2)
+  {
+    struct vrc6_pulse* pulse = &audio.pulse[channel];
+
+    switch (reg) {
+      case 0:
+        pulse->volume = data & 0x0F;
+        pulse->duty = (data >> 4) & 0x07;
+        pulse->constant = data >> 7;
+        break;
+      case 1:
+        pulse->period = (pulse->period & 0x0F00) | data;
+        break;
+      case 2:
+        pulse->period = (pulse->period & 0x00FF) | ((data & 0x0F) << 8);
+        pulse->enabled = data >> 7;
+
+        if (!pulse->enabled)
+        {
+          pulse->step = 15;
+        }
+        break;
+    }
+  }
+  else
+  {
+    switch (reg) {
+      case 0:
+        audio.saw_rate = data & 0x3F;
+        break;
+      case 1:
+        audio.saw_period = (audio.saw_period & 0x0F00) | data;
+        break;
+      case 2:
+        audio.saw_period = (audio.saw_period & 0x00FF) | ((data & 0x0F) << 8);
+        audio.saw_enabled = data >> 7;
+
+        if (!audio.saw_enabled)
+        {
+          audio.saw_step = 0;
+        }
+        break;
+    }
+  }
+}
+
+static void vrc6_write(uint16_t address, uint8_t data)
+{
+  int reg = address & 0x03;
+
+  if (swap_lines)
+  {
+    reg = ((reg & 0x01) << 1) | ((reg & 0x02) >> 1);
+  }
+
+  switch (address & 0xF000) {
+    case 0x8000:
+      map_prg(0, (data & 0x0F) * 2);
+      map_prg(1, (data & 0x0F) * 2 + 1);
+      break;
+    case 0x9000:
+    case 0xA000:
+    case 0xB000:
+      if (reg == 3)
+      {
+        if ((address & 0xF000) == 0xB000)
+        {
+          cartridge.vertical_mirroring = !(data & 0x0C);
+        }
+      }
+      else
+      {
+        vrc6_audio_write(((address >> 12) & 0x0F) - 9, reg, data);
+      }
+      break;
+    case 0xC000:
+      map_prg(2, data & 0x1F);
+      break;
+    case 0xD000:
+      map_chr(reg, data);
+      break;
+    case 0xE000:
+      map_chr(4 + reg, data);
+      break;
+    case 0xF000:
+      irq_write(reg, data);
+      break;
+  }
+}
+
+static void vrc_reset()
+{
+  memset(&vrc_irq, 0, sizeof(vrc_irq));
+  memset(&audio, 0, sizeof(audio));
+  mapper_irq = irq_event;
+  vrc_irq.sync_clock = system_clock(cycles);
+  vrc_irq.prescaler = DOTS_PER_SCANLINE;
+  audio.sync_clock = system_clock(cycles);
+  audio.pulse[0].step = 15;
+  audio.pulse[1].step = 15;
+  audio.pulse[0].timer = 1;
+  audio.pulse[1].timer = 1;
+  audio.saw_timer = 1;
+}
+
+void vrc6_init(int swap)
+{
+  vrc_reset();
+  swap_lines = swap;
+  mapper_write = vrc6_write;
+  mapper_audio = vrc6_audio;
+  map_prg(0, 0);
+  map_prg(1, 1);
+  map_prg(2, -2);
+  map_prg(3, -1);
+}
+
+/* VRC7. Its FM synthesizer is not emulated, writes to $9010/$9030 are
+ * ignored. */
+static void vrc7_write(uint16_t address, uint8_t data)
+{
+  /* VRC7a decodes A4, VRC7b A3, accept either */
+  int high = (address & 0x0018) != 0;
+
+  switch (address & 0xF000) {
+    case 0x8000:
+      map_prg(high, data & 0x3F);
+      break;
+    case 0x9000:
+      if (!high)
+      {
+        map_prg(2, data & 0x3F);
+      }
+      break;
+    case 0xA000:
+    case 0xB000:
+    case 0xC000:
+    case 0xD000:
+      map_chr(((address >> 12) - 0x0A) * 2 + high, data);
+      break;
+    case 0xE000:
+      if (!high)
+      {
+        cartridge.vertical_mirroring = !(data & 0x03);
+      }
+      else
+      {
+        irq_write(0, data);
+      }
+      break;
+    case 0xF000:
+      irq_write(high ? 2 : 1, data);
+      break;
+  }
+}
+
+void vrc7_init()
+{
+  vrc_reset();
+  mapper_write = vrc7_write;
+  map_prg(0, 0);
+  map_prg(1, 1);
+  map_prg(2, 2);
+  map_prg(3, -1);
+}
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include "workers.h"
+#include "cartridge.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* How often a parent waiting on a worker checks that it is still alive */
+#define WORKER_POLL_NS 20000000
+
+/* A request slot is the repeat count followed by one action per instance,
+ * a response slot one result per instance */
+#define REQUEST_SIZE(worker) ((sizeof(int) + (worker)->count + 7) & ~(size_t) 7)
+#define RESPONSE_SIZE(worker) ((worker)->count * sizeof(struct vector_result))
+
+/* What a worker is booted with. It goes to the spawner with each spawn, so
+ * settings made after workers_create reach every worker. */
+struct worker_settings
+{
+  int index;
+  int skip_lag;
+  int stall_frames;
+  int reset_stuck;
+  struct reward_term rewards[VECTOR_MAX_TERMS];
+  int reward_count;
+  struct done_term dones[VECTOR_MAX_TERMS];
+  int done_count;
+};
+
+static uint8_t* request_slot(struct worker* worker, unsigned index)
+{
+  return (uint8_t*) (worker->shared + 1) + (index % WORKER_SLOTS) * REQUEST_SIZE(worker);
+}
+
+static struct vector_result* response_slot(struct worker* worker, unsigned index)
+{
+  uint8_t* slots = (uint8_t*) (worker->shared + 1) + WORKER_SLOTS * REQUEST_SIZE(worker);
+  return (struct vector_result*) (slots + (index % WORKER_SLOTS) * RESPONSE_SIZE(worker));
+}
+
+/* The segment is shared between processes, so the futexes are not private */
+static void futex_wait(atomic_uint* word, unsigned value, const struct timespec* timeout)
+{
+  syscall(SYS_futex, word, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word)
+{
+  syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wait for room at the tail of a ring and return the slot index */
+static unsigned ring_reserve(struct worker_ring* ring)
+{
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  unsigned head;
+
+  while (tail - (head = atomic_load_explicit(&ring->head, memory_order_acquire)) == WORKER_SLOTS)
+  {
+    futex_wait(&ring->head, head, NULL);
+  }
+
+  return tail;
+}
+
+static void ring_publish(struct worker_ring* ring, unsigned tail)
+{
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  futex_wake(&ring->tail);
+}
+
+/* Wait for an entry at the head of a ring. A timeout makes this return -1
+ * when the ring is still empty after it. */
+static int ring_wait(struct worker_ring* ring, unsigned* index, const struct timespec* timeout)
+{
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+  {
+    futex_wait(&ring->tail, head, timeout);
+    if (timeout && atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+    {
+      return -1;
+    }
+  }
+
+  *index = head;
+  return 0;
+}
+
+static void ring_release(struct worker_ring* ring, unsigned head)
+{
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  futex_wake(&ring->head);
+}
+
+/* Boot this worker's instances and serve steps until the parent goes away */
+static void worker_main(struct workers* workers, struct worker* worker,
+    const struct worker_settings* settings)
+{
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() == 1)
+  {
+    _exit(1);
+  }
+
+  struct vector* vector = vector_create(worker->count, workers->rom, workers->rom_size,
+      workers->boot_frames);
+  if (!vector)
+  {
+    _exit(1);
+  }
+
+  vector->skip_lag = settings->skip_lag;
+  vector->stall_frames = settings->stall_frames;
+  vector->reset_stuck = settings->reset_stuck;
+  memcpy(vector->rewards, settings->rewards, sizeof(vector->rewards));
+  vector->reward_count = settings->reward_count;
+  memcpy(vector->dones, settings->dones, sizeof(vector->dones));
+  vector->done_count = settings->done_count;
+
+  float* rewards = malloc(worker->count * sizeof(float));
+  uint8_t* dones = malloc(worker->count);
+  struct input_frame* frames = malloc(worker->count * sizeof(struct input_frame));
+
+  while (1)
+  {
+    unsigned request;
+    ring_wait(&worker->shared->requests, &request, NULL);
+    uint8_t* slot = request_slot(worker, request);
+    vector_step(vector, slot + sizeof(int), *(int*) slot, rewards, dones, frames);
+    ring_release(&worker->shared->requests, request);
+
+    unsigned response = ring_reserve(&worker->shared->responses);
+    struct vector_result* results = response_slot(worker, response);
+    for (int env = 0; env < worker->count; env++)
+    {
+      results[env].reward = rewards[env];
+      results[env].done = dones[env];
+      results[env].stuck = vector->stuck[env];
+      results[env].frame = frames[env];
+    }
+    ring_publish(&worker->shared->responses, response);
+  }
+}
+
+/* Fork a worker for each request and answer with its pid, until the parent
+ * closes its end. A worker being replaced has exited, and is reaped only
+ * then so its pid is not reused while the parent still watches it. */
+static void spawner_main(struct workers* workers, int socket)
+{
+  struct worker_settings settings;
+
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() == 1)
+  {
+    _exit(1);
+  }
+
+  while (recv(socket, &settings, sizeof(settings), 0) == sizeof(settings))
+  {
+    struct worker* worker = &workers->workers[settings.index];
+
+    if (worker->pid > 0)
+    {
+      waitpid(worker->pid, NULL, 0);
+    }
+
+    worker->pid = fork();
+    if (worker->pid == 0)
+    {
+      close(socket);
+      worker_main(workers, worker, &settings);
+    }
+
+    send(socket, &worker->pid, sizeof(worker->pid), MSG_NOSIGNAL);
+  }
+
+  while (wait(NULL) > 0)
+  {
+  }
+  _exit(0);
+}
+
+/* Have the spawner boot a worker with the current settings */
+static int spawn(struct workers* workers, struct worker* worker)
+{
+  struct worker_settings settings = {
+    .index = worker - workers->workers,
+    .skip_lag = workers->skip_lag,
+    .stall_frames = workers->stall_frames,
+    .reset_stuck = workers->reset_stuck,
+    .reward_count = workers->reward_count,
+    .done_count = workers->done_count
+  };
+  memcpy(settings.rewards, workers->rewards, sizeof(settings.rewards));
+  memcpy(settings.dones, workers->dones, sizeof(settings.dones));
+  memset(worker->shared, 0, sizeof(struct worker_shared));
+
+  if (send(workers->spawner_socket, &settings, sizeof(settings), MSG_NOSIGNAL) != sizeof(settings) ||
+      recv(workers->spawner_socket, &worker->pid, sizeof(worker->pid), 0) != sizeof(worker->pid) ||
+      worker->pid < 0)
+  {
+    worker->pid = 0;
+    return -1;
+  }
+
+  worker->pidfd = syscall(SYS_pidfd_open, worker->pid, 0);
+  if (worker->pidfd < 0)
+  {
+    kill(worker->pid, SIGKILL);
+    worker->pid = 0;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* The parent's side of a worker that exited or was never started */
+static void forget(struct worker* worker)
+{
+  if (worker->pidfd >= 0)
+  {
+    close(worker->pidfd);
+  }
+  worker->pid = 0;
+  worker->pidfd = -1;
+}
+
+/* Split count instances of an iNES image over processes workers. The ROM
+ * is booted once here, so one that does not load, such as an unsupported
+ * mapper, is refused rather than crashing every worker. Call before the
+ * process starts other threads, as the spawner is forked here. Terms and
+ * the settings are set before workers_start. NULL when the ROM does not
+ * load or the workers cannot be set up. */
+struct workers* workers_create(int count, int processes, const uint8_t* rom, size_t size,
+    int boot_frames)
+{
+  if (processes < 1 || processes > count)
+  {
+    return NULL;
+  }
+
+  struct vector* probe = vector_create(1, rom, size, 0);
+  if (!probe)
+  {
+    return NULL;
+  }
+  vector_destroy(probe);
+
+  struct workers* workers = calloc(1, sizeof(struct workers));
+  workers->count = count;
+  workers->processes = processes;
+  workers->boot_frames = boot_frames;
+  workers->stuck = calloc(count, 1);
+  workers->spawner_socket = -1;
+  workers->rom = malloc(size);
+  workers->rom_size = size;
+  memcpy(workers->rom, rom, size);
+  workers->workers = calloc(processes, sizeof(struct worker));
+
+  for (int index = 0; index < processes; index++)
+  {
+    struct worker* worker = &workers->workers[index];
+    worker->first = index * count / processes;
+    worker->count = (index + 1) * count / processes - worker->first;
+    worker->fd = -1;
+    worker->pidfd = -1;
+  }
+
+  /* Every segment is mapped before the spawner forks, so the workers it
+   * forks share them */
+  for (int index = 0; index < processes; index++)
+  {
+    struct worker* worker = &workers->workers[index];
+    worker->size = sizeof(struct worker_shared) +
+      WORKER_SLOTS * (REQUEST_SIZE(worker) + RESPONSE_SIZE(worker));
+
+    worker->fd = memfd_create("nes-worker", MFD_CLOEXEC);
+    if (worker->fd < 0 || ftruncate(worker->fd, worker->size))
+    {
+      workers_destroy(workers);
+      return NULL;
+    }
+
+    worker->shared = mmap(NULL, worker->size, PROT_READ | PROT_WRITE, MAP_SHARED, worker->fd, 0);
+    if (worker->shared == MAP_FAILED)
+    {
+      worker->shared = NULL;
+      workers_destroy(workers);
+      return NULL;
+    }
+  }
+
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets))
+  {
+    workers_destroy(workers);
+    return NULL;
+  }
+
+  workers->spawner = fork();
+  if (workers->spawner == 0)
+  {
+    close(sockets[0]);
+    spawner_main(workers, sockets[1]);
+  }
+
+  close(sockets[1]);
+  workers->spawner_socket = sockets[0];
+  if (workers->spawner < 0)
+  {
+    workers_destroy(workers);
+    return NULL;
+  }
+
+  return workers;
+}
+
+void workers_destroy(struct workers* workers)
+{
+  for (int index = 0; index < workers->processes; index++)
+  {
+    struct worker* worker = &workers->workers[index];
+
+    if (worker->pid > 0)
+    {
+      kill(worker->pid, SIGKILL);
+    }
+    forget(worker);
+    if (worker->shared)
+    {
+      munmap(worker->shared, worker->size);
+    }
+    if (worker->fd >= 0)
+    {
+      close(worker->fd);
+    }
+  }
+
+  /* The spawner reaps the workers and exits once its socket closes */
+  if (workers->spawner_socket >= 0)
+  {
+    close(workers->spawner_socket);
+  }
+  if (workers->spawner > 0)
+  {
+    waitpid(workers->spawner, NULL, 0);
+  }
+
+  free(workers->workers);
+  free(workers->stuck);
+  free(workers->rom);
+  free(workers);
+}
+
+int workers_add_reward(struct workers* workers, struct reward_term term)
+{
+  if (workers->reward_count == VECTOR_MAX_TERMS)
+  {
+    return -1;
+  }
+
+  workers->rewards[workers->reward_count++] = term;
+  return 0;
+}
+
+int workers_add_done(struct workers* workers, struct done_term term)
+{
+  if (workers->done_count == VECTOR_MAX_TERMS)
+  {
+    return -1;
+  }
+
+  workers->dones[workers->done_count++] = term;
+  return 0;
+}
+
+/* Boot every worker */
+int workers_start(struct workers* workers)
+{
+  for (int index = 0; index < workers->processes; index++)
+  {
+    if (spawn(workers, &workers->workers[index]))
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Collect a worker's results, or find that it died, which returns -1. The
+ * spawner reaps it as it boots the replacement. */
+static int collect(struct workers* workers, struct worker* worker, float* rewards,
+    uint8_t* dones, struct input_frame* frames)
+{
+  struct timespec timeout = {0, WORKER_POLL_NS};
+  struct pollfd exited = {worker->pidfd, POLLIN, 0};
+  unsigned response;
+
+  while (ring_wait(&worker->shared->responses, &response, &timeout))
+  {
+    if (poll(&exited, 1, 0) > 0)
+    {
+      return -1;
+    }
+  }
+
+  struct vector_result* results = response_slot(worker, response);
+  for (int env = 0; env < worker->count; env++)
+  {
+    rewards[worker->first + env] = results[env].reward;
+    dones[worker->first + env] = results[env].done;
+    workers->stuck[worker->first + env] = results[env].stuck;
+    if (frames)
+    {
+      frames[worker->first + env] = results[env].frame;
+    }
+  }
+  ring_release(&worker->shared->responses, response);
+
+  return 0;
+}
+
+/* Like vector_step, with every worker stepping its instances at once and
+ * the watchdog's verdicts left in stuck. Instances of a worker that crashed
+ * report done with no reward, and the worker is booted again on the next
+ * step. Returns the number of workers lost. */
+int workers_step(struct workers* workers, const uint8_t* actions, int repeat, float* rewards,
+    uint8_t* dones, struct input_frame* frames)
+{
+  int lost = 0;
+
+  for (int index = 0; index < workers->processes; index++)
+  {
+    struct worker* worker = &workers->workers[index];
+
+    if (!worker->pid && spawn(workers, worker))
+    {
+      continue;
+    }
+
+    unsigned request = ring_reserve(&worker->shared->requests);
+    uint8_t* slot = request_slot(worker, request);
+    *(int*) slot = repeat;
+    memcpy(slot + sizeof(int), actions + worker->first, worker->count);
+    ring_publish(&worker->shared->requests, request);
+  }
+
+  for (int index = 0; index < workers->processes; index++)
+  {
+    struct worker* worker = &workers->workers[index];
+
+    if (worker->pid <= 0 || collect(workers, worker, rewards, dones, frames))
+    {
+      forget(worker);
+      lost++;
+
+      for (int env = worker->first; env < worker->first + worker->count; env++)
+      {
+        rewards[env] = 0;
+        dones[env] = 1;
+        workers->stuck[env] = 0;
+        if (frames)
+        {
+          memset(&frames[env], 0, sizeof(struct input_frame));
+        }
+      }
+    }
+  }
+
+  return lost;
+}
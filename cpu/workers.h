@@ -0,0 +1,75 @@
+#ifndef C_WORKERS_H
+#define C_WORKERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "vector.h"
+
+/* A vector environment split over worker processes, so a ROM or mapper that
+ * crashes the emulator only takes its own worker down. Each worker runs a
+ * struct vector over its share of the instances and talks to the parent
+ * through two single-producer rings in a memfd segment, waking the other
+ * side with a futex on the ring's tail. Workers are forked by a spawner
+ * process that workers_create forks first, so none is a copy of a parent
+ * whose other threads may hold locks. */
+#define WORKER_SLOTS 4
+
+struct worker_ring
+{
+  atomic_uint head;
+  atomic_uint tail;
+};
+
+/* Start of each worker's segment, followed by the request slots and the
+ * response slots */
+struct worker_shared
+{
+  struct worker_ring requests;
+  struct worker_ring responses;
+};
+
+struct worker
+{
+  pid_t pid;
+  /* Readable once the worker has exited */
+  int pidfd;
+  int first;
+  int count;
+  int fd;
+  size_t size;
+  struct worker_shared* shared;
+};
+
+struct workers
+{
+  int count;
+  int processes;
+  int boot_frames;
+  int skip_lag;
+  /* The vector watchdog's settings, and its verdicts from the last step */
+  int stall_frames;
+  int reset_stuck;
+  uint8_t* stuck;
+  pid_t spawner;
+  int spawner_socket;
+  uint8_t* rom;
+  size_t rom_size;
+  struct reward_term rewards[VECTOR_MAX_TERMS];
+  int reward_count;
+  struct done_term dones[VECTOR_MAX_TERMS];
+  int done_count;
+  struct worker* workers;
+};
+
+struct workers* workers_create(int count, int processes, const uint8_t* rom, size_t size,
+    int boot_frames);
+void workers_destroy(struct workers* workers);
+int workers_add_reward(struct workers* workers, struct reward_term term);
+int workers_add_done(struct workers* workers, struct done_term term);
+int workers_start(struct workers* workers);
+int workers_step(struct workers* workers, const uint8_t* actions, int repeat, float* rewards,
+    uint8_t* dones, struct input_frame* frames);
+
+#endif
@@ -0,0 +1,192 @@
+#include "cartridge.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+
+#define ZIP_END_SIGNATURE 0x06054B50
+#define ZIP_CENTRAL_SIGNATURE 0x02014B50
+#define ZIP_LOCAL_SIGNATURE 0x04034B50
+#define ZIP_END_SIZE 22
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_MAX_COMMENT 0xFFFF
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+#define ZIP_CHUNK 0x10000
+/* Far above any real cartridge, so a forged size never reaches malloc */
+#define ZIP_MAX_IMAGE 0x1000000
+
+static uint16_t le16(const uint8_t* p)
+{
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const uint8_t* p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/* Find the end of central directory record in the last bytes of the file,
+ * returning its offset */
+static long read_end(FILE* file, uint8_t* end)
+{
+  if (fseek(file, 0, SEEK_END))
+  {
+    return -1;
+  }
+
+  long length = ftell(file);
+  long tail = length < ZIP_END_SIZE + ZIP_MAX_COMMENT ? length : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+  uint8_t* buffer = malloc(tail);
+  long found = -1;
+
+  if (buffer && tail >= ZIP_END_SIZE && !fseek(file, length - tail, SEEK_SET) && fread(buffer, 1, tail, file) == (size_t) tail)
+  {
+    for (long offset = tail - ZIP_END_SIZE; offset >= 0; offset--)
+    {
+      if (le32(buffer + offset) == ZIP_END_SIGNATURE)
+      {
+        memcpy(end, buffer + offset, ZIP_END_SIZE);
+        found = length - tail + offset;
+        break;
+      }
+    }
+  }
+
+  free(buffer);
+  return found;
+}
+
+/* Inflate one entry straight into a new image, reading the compressed data
+ * in chunks so the archive is never held in memory */
+static struct rom_image* read_entry(FILE* file, const uint8_t* entry)
+{
+  uint16_t method = le16(entry + 10);
+  uint32_t crc = le32(entry + 16);
+  uint32_t compressed = le32(entry + 20);
+  uint32_t size = le32(entry + 24);
+  uint8_t local[ZIP_LOCAL_SIZE];
+
+  if ((method != ZIP_STORED && method != ZIP_DEFLATED) || size > ZIP_MAX_IMAGE || fseek(file, le32(entry + 42), SEEK_SET) ||
+      fread(local, 1, ZIP_LOCAL_SIZE, file) != ZIP_LOCAL_SIZE || le32(local) != ZIP_LOCAL_SIGNATURE ||
+      fseek(file, le16(local + 26) + le16(local + 28), SEEK_CUR))
+  {
+    return NULL;
+  }
+
+  struct rom_image* image = malloc(sizeof(struct rom_image) + size);
+  if (!image)
+  {
+    return NULL;
+  }
+
+  image->crc = crc;
+  image->size = size;
+  int ok = 0;
+
+  if (method == ZIP_STORED)
+  {
+    ok = compressed == size && fread(image->data, 1, size, file) == size;
+  }
+  else
+  {
+    uint8_t* chunk = malloc(ZIP_CHUNK);
+    z_stream stream = {0};
+    int status = chunk ? inflateInit2(&stream, -MAX_WBITS) : Z_MEM_ERROR;
+    stream.next_out = image->data;
+    stream.avail_out = size;
+
+    while (status == Z_OK && compressed)
+    {
+      stream.avail_in = fread(chunk, 1, compressed < ZIP_CHUNK ? compressed : ZIP_CHUNK, file);
+      stream.next_in = chunk;
+      compressed -= stream.avail_in;
+      status = stream.avail_in ? inflate(&stream, Z_NO_FLUSH) : Z_DATA_ERROR;
+    }
+
+    ok = status == Z_STREAM_END && stream.total_out == size;
+    if (chunk)
+    {
+      inflateEnd(&stream);
+    }
+    free(chunk);
+  }
+
+  if (!ok || rom_crc32(0, image->data, size) != crc)
+  {
+    free(image);
+    return NULL;
+  }
+
+  return image;
+}
+
+/* Load the first .nes entry of a zip archive */
+int load_zip(FILE* file)
+{
+  struct rom_image* image = read_zip(file);
+  return image ? load_image(image) : -1;
+}
+
+/* Take a reference to the first .nes entry of a zip archive. The directory
+ * CRC finds an image already inflated by another instance before anything
+ * is read. */
+struct rom_image* read_zip(FILE* file)
+{
+  uint8_t end[ZIP_END_SIZE];
+  long offset = read_end(file, end);
+  if (offset < 0)
+  {
+    return NULL;
+  }
+
+  /* The directory has to fit between its offset and the end record, so a
+   * forged size never reaches malloc */
+  uint16_t entries = le16(end + 10);
+  uint32_t length = le32(end + 12);
+  if (length > offset || le32(end + 16) > offset - length)
+  {
+    return NULL;
+  }
+
+  uint8_t* directory = malloc(length);
+  const uint8_t* entry = NULL;
+
+  if (!directory)
+  {
+    return NULL;
+  }
+
+  if (!fseek(file, le32(end + 16), SEEK_SET) && fread(directory, 1, length, file) == length)
+  {
+    const uint8_t* p = directory;
+    for (int index = 0; index < entries && p + ZIP_CENTRAL_SIZE <= directory + length; index++)
+    {
+      uint16_t name = le16(p + 28);
+      if (le32(p) != ZIP_CENTRAL_SIGNATURE || p + ZIP_CENTRAL_SIZE + name > directory + length)
+      {
+        break;
+      }
+      if (name >= 4 && !strncasecmp((const char*) p + ZIP_CENTRAL_SIZE + name - 4, ".nes", 4))
+      {
+        entry = p;
+        break;
+      }
+      p += ZIP_CENTRAL_SIZE + name + le16(p + 30) + le16(p + 32);
+    }
+  }
+
+  struct rom_image* image = NULL;
+  if (entry)
+  {
+    image = rom_cache_acquire(le32(entry + 16), le32(entry + 24));
+    if (!image && (image = read_entry(file, entry)))
+    {
+      image = rom_cache_insert(image);
+    }
+  }
+
+  free(directory);
+  return image;
+}
@@ -0,0 +1,71 @@
+#!usr/bin/python
+
+# Generates a perfect hash table of header corrections from a game database.
+# A key lands in slot fmix(crc ^ seed[crc % buckets]) & mask, seeds are
+# searched here so that no two keys share a slot.
+# Usage: gamedb_generator.py gamedb [more databases...] > cpu/gamedb.c
+
+import sys
+
+mirrorings = {"horizontal" : "mirroring_horizontal", "vertical" : "mirroring_vertical",
+    "four_screen" : "mirroring_four_screen"}
+regions = {"ntsc" : "region_ntsc", "pal" : "region_pal", "dendy" : "region_dendy"}
+
+# Murmur3 finalizer, must match gamedb_hash in cartridge.c
+def fmix(h):
+    h ^= h >> 16
+    h = (h * 0x85EBCA6B) & 0xFFFFFFFF
+    h ^= h >> 13
+    h = (h * 0xC2B2AE35) & 0xFFFFFFFF
+    h ^= h >> 16
+    return h
+
+entries = {}
+lines = [line for path in sys.argv[1:] for line in open(path, "r")]
+for line in lines:
+    if (line[0] == '#' or line.strip() == ""):
+        continue
+    crc, mapper, submapper, mirroring, prg_ram, chr_ram, region = line.strip().split(',')
+    crc = int(crc, 16)
+    if crc in entries:
+        sys.exit("gamedb_generator: duplicate CRC " + format(crc, "08X"))
+    entries[crc] = "{" + format(crc, "#010x") + ", " + mapper + ", " + submapper + ", " + \
+        mirrorings[mirroring] + ", " + prg_ram + ", " + chr_ram + ", " + regions[region] + ", 1}"
+
+size = 1
+while size < len(entries) * 5 // 4 + 1:
+    size *= 2
+mask = size - 1
+bucket_count = max(1, (len(entries) + 3) // 4)
+
+buckets = [[] for bucket in range(bucket_count)]
+for crc in entries:
+    buckets[crc % bucket_count].append(crc)
+
+seeds = [0] * bucket_count
+slots = [None] * size
+for bucket in sorted(range(bucket_count), key = lambda bucket: len(buckets[bucket]), reverse = True):
+    if not buckets[bucket]:
+        continue
+    seed = 1
+    while True:
+        positions = [fmix(crc ^ seed) & mask for crc in buckets[bucket]]
+        if len(set(positions)) == len(positions) and all(slots[position] is None for position in positions):
+            break
+        seed += 1
+    seeds[bucket] = seed
+    for crc, position in zip(buckets[bucket], positions):
+        slots[position] = crc
+
+str = "/* Generated by gamedb_generator.py, do not edit */\n"
+str += "#include \"cartridge.h\"\n\n"
+str += "const int gamedb_buckets = " + format(bucket_count) + ";\n"
+str += "const uint32_t gamedb_mask = " + format(mask, "#x") + ";\n\n"
+str += "const uint32_t gamedb_seeds[] = {\n"
+str += ",\n".join("  " + format(seed) for seed in seeds)
+str += "\n};\n\n"
+str += "const struct game_entry gamedb_entries[] = {\n"
+str += ",\n".join("  " + (entries[crc] if crc is not None else "{0}") for crc in slots)
+str += "\n};\n"
+
+sys.stdout.write(str)
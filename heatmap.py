@@ -0,0 +1,44 @@
+#!usr/bin/python
+
+# Render the per-frame page counters written by heatmap_end_frame and rank
+# pages by traffic. Usage: heatmap.py <file> [read|write|execute|all] [top]
+
+import struct
+import sys
+
+PAGES = 256
+FRAME = PAGES * 3 * 4
+KINDS = {"read" : [0], "write" : [1], "execute" : [2], "all" : [0, 1, 2]}
+SHADES = " .:-=+*#%@"
+
+data = open(sys.argv[1], "rb").read()
+kind = sys.argv[2] if len(sys.argv) > 2 else "all"
+top = int(sys.argv[3]) if len(sys.argv) > 3 else 16
+
+frames = len(data) // FRAME
+totals = [[0, 0, 0] for page in range(PAGES)]
+for frame in range(frames):
+    counts = struct.unpack_from("<%dI" % (PAGES * 3), data, frame * FRAME)
+    for page in range(PAGES):
+        for access in range(3):
+            totals[page][access] += counts[page * 3 + access]
+
+traffic = [sum(totals[page][access] for access in KINDS[kind]) for page in range(PAGES)]
+peak = max(traffic) or 1
+
+print("%d frames, %s accesses" % (frames, kind))
+print("    " + "".join(format(low, "X") for low in range(16)))
+for high in range(16):
+    row = ""
+    for low in range(16):
+        level = traffic[high * 16 + low] * (len(SHADES) - 1) // peak
+        row += SHADES[level]
+    print("$" + format(high, "X") + "x " + row)
+
+print("")
+print("page   reads      writes     executes")
+ranked = sorted(range(PAGES), key = lambda page: traffic[page], reverse = True)
+for page in ranked[:top]:
+    if traffic[page] == 0:
+        break
+    print("$%02X00  %-10d %-10d %-10d" % (page, totals[page][0], totals[page][1], totals[page][2]))
@@ -1,32 +1,114 @@
 #!usr/bin/python
 
-address_modes = {0 : "ZERO_PAGE", 1 : "IND_ZERO_PAGE_X", 2: "IND_ZERO_PAGE_Y", 3 : "ABSOLUTE", 4 : "IND_ABSOLUTE_X", 5 : "IND_ABSOLUTE_Y", 6 : "INDIRECT", 7 : "RELATIVE", 8 : "INDEXED_INDIRECT_X", 9 : "INDEXED_INDIRECT_Y", 10 : "IMMEDIATE" }
+# Generates cpu/dispatch.c from the opcode table. Every opcode gets its own
+# handler with the addressing mode, the operation and the cycle cost fused,
+# so nothing about the mode is decided at run time.
+# Usage: opcode_generator.py opcode cpu/opcodes.h > cpu/dispatch.c
 
-f = open("opcode", "r")
-str = "void perform_instruction(uint8_t opcode, uint16_t address)\n{\n\tswitch (opcode) {\n";
+import re
+import sys
+
+# Maps the table's modes onto enum address_mode in opcodes.h
+enum_modes = {"implied" : "implied", "accumulator" : "implied", "immediate" : "immediate",
+    "zero_page" : "zero_page", "zero_page_x" : "ind_zero_page", "zero_page_y" : "ind_zero_page",
+    "absolute" : "absolute", "absolute_x" : "ind_absolute", "absolute_y" : "ind_absolute",
+    "indirect" : "indirect", "indexed_indirect" : "indexed_indirect",
+    "indirect_indexed" : "indirect_indexed", "relative" : "relative"}
+
+# Lines computing `target` for every mode that addresses memory
+targets = {
+    "zero_page" : ["uint16_t target = READ(address + 1);"],
+    "zero_page_x" : ["uint16_t target = (uint8_t) (READ(address + 1) + index_x);"],
+    "zero_page_y" : ["uint16_t target = (uint8_t) (READ(address + 1) + index_y);"],
+    "absolute" : ["uint16_t target = ADDR_16(address + 1);"],
+    "absolute_x" : ["uint16_t base = ADDR_16(address + 1);",
+        "uint16_t target = base + index_x;"],
+    "absolute_y" : ["uint16_t base = ADDR_16(address + 1);",
+        "uint16_t target = base + index_y;"],
+    "indirect" : ["uint16_t pointer = ADDR_16(address + 1);",
+        "uint16_t target = READ(pointer) | READ((pointer & 0xFF00) | (uint8_t) (pointer + 1)) << 8;",
+        "CDL_LOG_PRG(target, CDL_INDIRECT_CODE);"],
+    "indexed_indirect" : ["uint8_t pointer = READ(address + 1) + index_x;",
+        "uint16_t target = READ(pointer) | READ((uint8_t) (pointer + 1)) << 8;",
+        "CDL_LOG_PRG(target, CDL_INDIRECT_DATA);"],
+    "indirect_indexed" : ["uint8_t pointer = READ(address + 1);",
+        "uint16_t base = READ(pointer) | READ((uint8_t) (pointer + 1)) << 8;",
+        "uint16_t target = base + index_y;",
+        "CDL_LOG_PRG(target, CDL_INDIRECT_DATA);"]
+}
+
+# Operand passed to handlers taking a value in modes without a target
+values = {"implied" : "0", "accumulator" : "accumulator",
+    "immediate" : "READ(address + 1)", "relative" : "READ(address + 1)"}
+
+# Read handler signatures so the call matches the function
+handlers = {}
+for line in open(sys.argv[2], "r"):
+    match = re.match(r"(void|uint8_t) (\w+)\((.*)\);", line)
+    if match:
+        handlers[match.group(2)] = (match.group(1), match.group(3))
+
+def call(name, mode):
+    returns, params = handlers[name]
+    addressed = mode in targets
+    if returns == "uint8_t":
+        if addressed:
+            return "write(target, " + name + "(READ(target)));"
+        return "accumulator = " + name + "(accumulator);"
+    if params == "":
+        # Unofficial NOPs still make their dummy read
+        return ("READ(target);\n  " if addressed else "") + name + "();"
+    if params == "uint16_t address":
+        return name + "(target);"
+    if params == "uint16_t address, uint8_t value":
+        return name + "(target, READ(target));"
+    return name + "(" + ("READ(target)" if addressed else values[mode]) + ");"
+
+str = "/* Generated by opcode_generator.py from the opcode table, do not edit */\n"
+str += "#include \"opcodes.h\"\n\n"
+str += "/* Opcodes without a handler jam the CPU like STP rather than hang it */\n"
+str += "static void op_unimplemented(uint16_t address)\n{\n  pc = address + 1;\n  cycles += 2;\n  STP();\n}\n"
+
+table = []
+instructions = []
+missing = []
 opcode = 0
-for line in f:
-    if (line[0] == '#'):
-        continue;
-    tokens = line.split(',')
-    str += "\t\tcase " + format(opcode, '#04X') + ":\n"
-    str += "\t\t\t" + tokens[0] + "("
-    if (tokens[1] == '0'):
-        str += address_modes[int(tokens[2])] + "(address)"
-    elif (tokens[1] == '1'):
-        str += "address, " + address_modes[int(tokens[2])]
-    elif (tokens[1] == '2'):
-        str += "address"
-    elif (tokens[1] == '3'):
-        str += address_modes[int(tokens[2])] + "(address), address, 1"
-
-    str += ");\n"
-    str += "\t\t\t/* size = " + tokens[3] + "; */\n"
-    str += "\t\t\tcycles = " + tokens[4][:1] + ";\n"
-    str += "\t\t\tbreak;\n"
+for line in open(sys.argv[1], "r"):
+    if (line[0] == '#' or line.strip() == ""):
+        continue
+    name, mode, size, cost = line.strip().split(',')
+    instructions.append("  {\"" + name + "\", " + enum_modes[mode] + ", " + size + ", " + cost.rstrip('*') + "}")
+
+    if name not in handlers:
+        if name not in missing:
+            missing.append(name)
+        table.append("op_unimplemented")
+        opcode += 1
+        continue
+
+    function = "op_" + format(opcode, '02x')
+    table.append(function)
+    cycles = cost.rstrip('*')
+    if cost.endswith('*'):
+        cycles += " + ((base ^ target) > 0xFF)"
+
+    str += "\n/* " + format(opcode, '#04x') + " " + name + " " + mode + " */\n"
+    str += "static void " + function + "(uint16_t address)\n{\n"
+    for target in targets.get(mode, []):
+        str += "  " + target + "\n"
+    str += "  pc = address + " + size + ";\n"
+    str += "  cycles += " + cycles + ";\n"
+    str += "  " + call(name, mode) + "\n"
+    str += "}\n"
     opcode += 1
 
-str += "\t\tdefault:\n\t\t\tbreak;\n"
-str += "\t}\n}"
+if missing:
+    str += "\n/* No handler, these jam through op_unimplemented: " + ", ".join(missing) + " */\n"
+str += "\nvoid (*const opcode_table[256])(uint16_t address) = {\n"
+str += ",\n".join("  " + function for function in table)
+str += "\n};\n"
+str += "\nstruct instruction instruction_set[256] = {\n"
+str += ",\n".join(instructions)
+str += "\n};"
 
 print(str)
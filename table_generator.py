@@ -0,0 +1,63 @@
+#!usr/bin/python
+
+# Generates cpu/tables.c, the read-only lookup tables declared in tables.h.
+# Usage: table_generator.py palette > cpu/tables.c
+
+import sys
+
+N = 0x80
+V = 0x40
+Z = 0x02
+C = 0x01
+
+def nz(value):
+    return (value & N) | (Z if value == 0 else 0)
+
+def array(declaration, entries, width):
+    str = "\n" + declaration + " = {"
+    for index in range(len(entries)):
+        str += ("\n  " if index % 8 == 0 else " ") + format(entries[index], "#0" + width + "x") + ","
+    return str.rstrip(",") + "\n};\n"
+
+nz_flags = [nz(value) for value in range(256)]
+
+# Index is the 9-bit result of an add, bit 8 being the carry out
+nzc_flags = [nz(result & 0xFF) | (C if result > 0xFF else 0) for result in range(512)]
+
+# Index is sign of accumulator << 2 | sign of operand << 1 | sign of result.
+# SBC uses the inverted operand.
+overflow_flags = [V if (index >> 2) == ((index >> 1) & 1) and (index >> 2) != (index & 1) else 0
+    for index in range(8)]
+
+# Spreads bit n of a CHR bitplane byte to bit 2n. A row of pixels is
+# chr_interleave[low plane] | chr_interleave[high plane] << 1.
+chr_interleave = [sum(((plane >> bit) & 1) << (bit * 2) for bit in range(8)) for plane in range(256)]
+
+# Slicing-by-8 tables for the reflected CRC-32 polynomial
+crc32_tables = [[0] * 256 for table in range(8)]
+for value in range(256):
+    crc = value
+    for bit in range(8):
+        crc = (crc >> 1) ^ (0xEDB88320 if crc & 1 else 0)
+    crc32_tables[0][value] = crc
+for table in range(1, 8):
+    for value in range(256):
+        previous = crc32_tables[table - 1][value]
+        crc32_tables[table][value] = (previous >> 8) ^ crc32_tables[0][previous & 0xFF]
+
+palette_rgb = []
+for line in open(sys.argv[1], "r"):
+    if (line[0] == '#' or line.strip() == ""):
+        continue
+    palette_rgb += [int(color, 16) for color in line.strip().split(',')]
+
+str = "/* Generated by table_generator.py, do not edit */\n"
+str += "#include \"tables.h\"\n"
+str += array("const uint8_t nz_flags[256]", nz_flags, "4")
+str += array("const uint8_t nzc_flags[512]", nzc_flags, "4")
+str += array("const uint8_t overflow_flags[8]", overflow_flags, "4")
+str += array("const uint16_t chr_interleave[256]", chr_interleave, "6")
+str += array("const uint32_t palette_rgb[64]", palette_rgb, "8")
+str += array("const uint32_t crc32_tables[8 * 256]", sum(crc32_tables, []), "10")
+
+sys.stdout.write(str)
@@ -3,10 +3,34 @@
 int main()
 {
 
-  /* test_addresses();
+  test_addresses();
   test_stack();
   test_bitman();
-  test_opcodes(); */
+  test_opcodes();
+  test_dispatch();
+  test_tables();
+  test_dma();
+  test_mmc3();
+  test_mappers();
+  test_gamedb();
+  test_zip();
+  test_library();
+  test_region();
+  test_overclock();
+  test_input();
+  test_vector();
+  test_vector_async();
+  test_watchdog();
+  test_vector_state();
+  test_workers();
+  test_cheats();
+  test_hooks();
+  test_diff();
+  test_search();
+  test_cdl();
+  test_heatmap();
+  test_trace();
+  test_metrics();
 
   return 0;
 }
@@ -122,9 +146,1729 @@ void test_opcodes()
   assert(accumulator == 0x0D);
 
   /* Arithmetic shift left */
-  ASL(READ(0x1000), 0x1000, 1);
+  write(0x1000, ASL(READ(0x1000)));
   assert(READ(0x1000) == 0x08);
 
   /* Tear down */
   deinitialize_cpu();
 }
+
+void test_dispatch()
+{
+  /* Set up */
+  initialize_cpu();
+
+  /* Test */
+
+  /* LDA absolute,X charges the page crossing cycle */
+  memory[0x8000] = 0xBD;
+  memory[0x8001] = 0xF0;
+  memory[0x8002] = 0x12;
+  memory[0x1300] = 0x44;
+  index_x = 0x10;
+  cycles = 0;
+  perform_instruction(memory[0x8000], 0x8000);
+  assert(accumulator == 0x44);
+  assert(pc == 0x8003);
+  assert(cycles == 5);
+
+  /* ASL zero page and accumulator forms */
+  memory[0x8003] = 0x06;
+  memory[0x8004] = 0x20;
+  memory[0x0020] = 0x41;
+  perform_instruction(memory[pc], pc);
+  assert(READ(0x0020) == 0x82);
+  memory[0x8005] = 0x0A;
+  accumulator = 0x81;
+  perform_instruction(memory[pc], pc);
+  assert(accumulator == 0x02);
+  assert(getflag(c) == 1);
+  assert(pc == 0x8006);
+  assert(cycles == 12);
+
+  /* JMP indirect does not carry into the pointer's high byte */
+  memory[0x8006] = 0x6C;
+  memory[0x8007] = 0xFF;
+  memory[0x8008] = 0x02;
+  memory[0x02FF] = 0x34;
+  memory[0x0200] = 0x12;
+  perform_instruction(memory[pc], pc);
+  assert(pc == 0x1234);
+
+  /* The generated table matches the opcode listing */
+  assert(instruction_set[0x6C].size == 3);
+  assert(instruction_set[0x6C].mode == indirect);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_tables()
+{
+  /* Test */
+
+  /* Flag tables match the flags computed bit by bit */
+  for (int value = 0; value < 512; value++)
+  {
+    uint8_t result = value & 0xFF;
+    uint8_t flags = (result & 0x80) | (result ? 0 : 0x02);
+    assert(nzc_flags[value] == (flags | (value > 0xFF)));
+
+    if (value < 256)
+    {
+      assert(nz_flags[value] == flags);
+    }
+  }
+
+  for (int a = 0; a < 256; a += 5)
+  {
+    for (int m = 0; m < 256; m += 3)
+    {
+      uint8_t r = a + m;
+      uint8_t overflow = ((a ^ r) & (m ^ r) & 0x80) ? 0x40 : 0;
+      assert(overflow_flags[OVERFLOW_INDEX(a, m, r)] == overflow);
+    }
+  }
+
+  /* Bitplanes interleave into 2-bit pixels, leftmost pixel highest */
+  uint16_t row = chr_interleave[0x81] | chr_interleave[0x01] << 1;
+  assert(((row >> 14) & 0x03) == 0x01);
+  assert((row & 0x03) == 0x03);
+  assert(((row >> 2) & 0x03) == 0x00);
+
+  assert(palette_rgb[0x00] == 0x666666);
+  assert(palette_rgb[0x30] == 0xFFFEFF);
+  assert(palette_rgb[0x3F] == 0x000000);
+
+  /* ADC sets N, Z, C and V through the tables */
+  initialize_cpu();
+  accumulator = 0x50;
+  ADC(0x50);
+  assert(accumulator == 0xA0);
+  assert(getflag(v) == 1 && getflag(n) == 1);
+  assert(getflag(c) == 0 && getflag(z) == 0);
+  ADC(0x60);
+  assert(accumulator == 0x00);
+  assert(getflag(c) == 1 && getflag(z) == 1);
+  assert(getflag(v) == 0 && getflag(n) == 0);
+
+  /* SBC uses the same tables with the operand inverted */
+  accumulator = 0x50;
+  setflag(c, 1);
+  SBC(0x50);
+  assert(accumulator == 0x00 && getflag(z) == 1 && getflag(c) == 1);
+  assert(getflag(n) == 0 && getflag(v) == 0);
+  SBC(0x01);
+  assert(accumulator == 0xFF && getflag(z) == 0 && getflag(c) == 0);
+  assert(getflag(n) == 1 && getflag(v) == 0);
+  accumulator = 0x50;
+  setflag(c, 0);
+  SBC(0xB0);
+  assert(accumulator == 0x9F && getflag(v) == 1 && getflag(n) == 1 && getflag(c) == 0);
+
+  /* Compares set Z only when equal, C when the register is not below */
+  accumulator = 0x40;
+  CMP(0x40);
+  assert(getflag(z) == 1 && getflag(c) == 1 && getflag(n) == 0);
+  CMP(0x41);
+  assert(getflag(z) == 0 && getflag(c) == 0 && getflag(n) == 1);
+  CMP(0x10);
+  assert(getflag(z) == 0 && getflag(c) == 1 && getflag(n) == 0);
+  index_x = 0x00;
+  CPX(0x00);
+  assert(getflag(z) == 1 && getflag(c) == 1);
+  index_y = 0x80;
+  CPY(0x01);
+  assert(getflag(z) == 0 && getflag(c) == 1 && getflag(n) == 0);
+
+  /* BIT takes N and V from the operand and Z from the AND */
+  accumulator = 0x01;
+  BIT(0xC0);
+  assert(getflag(z) == 1 && getflag(n) == 1 && getflag(v) == 1);
+  BIT(0x01);
+  assert(getflag(z) == 0 && getflag(n) == 0 && getflag(v) == 0);
+  deinitialize_cpu();
+}
+
+void test_dma()
+{
+  /* Set up */
+  initialize_cpu();
+
+  for (int index = 0; index < 256; index++)
+  {
+    memory[0x0200 + index] = index ^ 0x5A;
+  }
+
+  /* Test */
+
+  /* STA $4014 copies page 2 once the instruction is done */
+  memory[0x8000] = 0x8D;
+  memory[0x8001] = 0x14;
+  memory[0x8002] = 0x40;
+  accumulator = 0x02;
+  cycles = 0;
+  perform_instruction(memory[0x8000], 0x8000);
+  assert(oam[0x00] == 0x5A && oam[0xFF] == 0xA5);
+  assert(cycles == 4 + 513);
+
+  /* Starting on an odd cycle costs one more */
+  cycles = 1;
+  write(OAM_DMA, 0x02);
+  run_events();
+  assert(cycles == 1 + 514);
+
+  /* DMC fetches are events every 8 output bits, each stealing 4 cycles */
+  cycles = 0;
+  memory[0xC040] = 0x11;
+  memory[0xC041] = 0x22;
+  write(0x4010, 0x0F);
+  write(0x4012, 0x01);
+  write(0x4013, 0x00);
+  write(0x4015, 0x10);
+  assert(next_event == 54 * 8);
+  cycles = 54 * 8;
+  run_events();
+  assert(dmc.sample == 0x11);
+  assert(cycles == 54 * 8 + 4);
+  assert(dmc.remaining == 0);
+  assert(next_event == LLONG_MAX);
+
+  /* Looping restarts the sample */
+  write(0x4010, 0x4F);
+  write(0x4015, 0x10);
+  cycles = next_event;
+  run_events();
+  assert(dmc.address == 0xC040);
+  assert(next_event == cycles + 54 * 8);
+  write(0x4015, 0x00);
+  assert(next_event == LLONG_MAX);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_mmc3()
+{
+  /* Set up: 8 PRG banks tagged with their number, IRQ vector at $E000 */
+  initialize_cpu();
+  size_t size = INES_HEADER_SIZE + 4 * 0x4000 + 0x2000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 4;
+  rom[5] = 1;
+  rom[6] = 0x40;
+
+  for (int bank = 0; bank < 8; bank++)
+  {
+    rom[INES_HEADER_SIZE + bank * PRG_BANK_SIZE] = bank;
+  }
+
+  rom[INES_HEADER_SIZE + 4 * 0x4000 - 2] = 0x00;
+  rom[INES_HEADER_SIZE + 4 * 0x4000 - 1] = 0xE0;
+  assert(load_rom(rom, size) == 0);
+
+  /* Test */
+
+  /* Bank 6 and 7 registers, second last and last banks fixed */
+  write(0x8000, 0x06);
+  write(0x8001, 0x03);
+  write(0x8000, 0x07);
+  write(0x8001, 0x05);
+  assert(READ(0x8000) == 3 && READ(0xA000) == 5);
+  assert(READ(0xC000) == 6 && READ(0xE000) == 7);
+  write(0x8000, 0x46);
+  assert(READ(0x8000) == 6 && READ(0xC000) == 3);
+
+  /* Sprites at $1000 clock the counter at dot 260; with a latch of 10 the
+   * IRQ lands on the 11th line */
+  cycles = 0;
+  write(PPU_CTRL, CTRL_SPRITE_TABLE);
+  write(PPU_MASK, MASK_RENDERING);
+  write(0xC000, 10);
+  write(0xC001, 0);
+  write(0xE001, 0);
+  assert(next_event == (10 * DOTS_PER_SCANLINE + 260 + 2) / 3);
+
+  /* Moving the background to $1000 delays the clocks to dot 324 */
+  cycles = 200;
+  write(PPU_CTRL, CTRL_BACKGROUND_TABLE);
+  assert(next_event == (10 * DOTS_PER_SCANLINE + 324 + 2) / 3);
+
+  /* The event raises the IRQ, the CPU takes it and the next is predicted
+   * latch + 1 lines later */
+  pc = 0x9000;
+  cycles = next_event;
+  run_events();
+  assert(irq_line == 1);
+  assert(pc == 0xE000);
+  assert(getflag(i) == 1);
+  assert(next_event == LLONG_MIN);
+  write(0xE000, 0);
+  assert(irq_line == 0);
+  assert(next_event == LLONG_MAX);
+  write(0xE001, 0);
+  assert(next_event == (21 * DOTS_PER_SCANLINE + 324 + 2) / 3);
+
+  /* Predictions run across the pre-render line into the next frame */
+  cycles = 0;
+  write(0xC000, 250);
+  write(0xC001, 0);
+  assert(next_event == (DOTS_PER_FRAME + 9 * DOTS_PER_SCANLINE + 324 + 2) / 3);
+
+  /* Disabling rendering stops the counter */
+  write(PPU_MASK, 0);
+  assert(next_event == LLONG_MAX);
+
+  /* Tear down */
+  free(rom);
+  deinitialize_cpu();
+}
+
+/* Load a 128KB PRG image whose 8KB banks start with their number */
+static void load_test_rom(int mapper)
+{
+  size_t size = INES_HEADER_SIZE + 8 * 0x4000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 8;
+  rom[6] = (mapper & 0x0F) << 4;
+  rom[7] = mapper & 0xF0;
+
+  for (int bank = 0; bank < 16; bank++)
+  {
+    rom[INES_HEADER_SIZE + bank * PRG_BANK_SIZE] = bank;
+  }
+
+  assert(load_rom(rom, size) == 0);
+  free(rom);
+}
+
+void test_mappers()
+{
+  /* Set up */
+  initialize_cpu();
+
+  /* Test */
+
+  /* VRC6: 16KB bank at $8000, IRQ counting CPU cycles up from the latch */
+  load_test_rom(24);
+  write(0x8000, 0x03);
+  write(0xC000, 0x09);
+  assert(READ(0x8000) == 6 && READ(0xA000) == 7);
+  assert(READ(0xC000) == 9 && READ(0xE000) == 15);
+  cycles = 0;
+  write(0xF000, 0xF0);
+  write(0xF001, 0x06);
+  assert(next_event == 0x10);
+  cycles = 0x10;
+  run_events();
+  assert(irq_line == 1);
+  write(0xF002, 0);
+  assert(irq_line == 0);
+
+  /* VRC6 pulse at full duty outputs its volume */
+  write(0x9000, 0x8F);
+  write(0x9002, 0x80);
+  assert(mapper_audio() == 15);
+  write(0x9002, 0x00);
+  assert(mapper_audio() == 0);
+
+  /* FME-7: commands through $8000/$A000, IRQ when the counter wraps */
+  deinitialize_cpu();
+  initialize_cpu();
+  load_test_rom(69);
+  write(0x8000, 0x09);
+  write(0xA000, 0x04);
+  write(0x8000, 0x08);
+  write(0xA000, 0x05);
+  assert(READ(0x8000) == 4 && READ(0x6000) == 5);
+  write(0x8000, 0x0E);
+  write(0xA000, 0x00);
+  write(0x8000, 0x0F);
+  write(0xA000, 0x01);
+  write(0x8000, 0x0D);
+  write(0xA000, 0x81);
+  assert(next_event == 0x101);
+
+  /* Sunsoft 5B tone with the channel disabled holds its volume */
+  write(0xC000, 0x07);
+  write(0xE000, 0x01);
+  write(0xC000, 0x08);
+  write(0xE000, 0x0F);
+  assert(mapper_audio() == 255);
+
+  /* Namco 163: IRQ counter stops at $7FFF */
+  deinitialize_cpu();
+  initialize_cpu();
+  load_test_rom(19);
+  write(0xE000, 0x02);
+  assert(READ(0x8000) == 2 && READ(0xE000) == 15);
+  write(0x5000, 0xF0);
+  write(0x5800, 0xFF);
+  assert(next_event == 0x0F);
+  cycles = 0x0F;
+  run_events();
+  assert(irq_line == 1);
+
+  /* MMC5: 8KB mode by default, 32KB mode, multiplier */
+  deinitialize_cpu();
+  initialize_cpu();
+  load_test_rom(5);
+  assert(READ(0xE000) == 15);
+  write(0x5114, 0x83);
+  assert(READ(0x8000) == 3);
+  write(0x5100, 0x00);
+  write(0x5117, 0x84);
+  assert(READ(0x8000) == 4 && READ(0xE000) == 7);
+  write(0x5205, 200);
+  write(0x5206, 3);
+  assert(READ(0x5205) == (600 & 0xFF) && READ(0x5206) == 600 >> 8);
+
+  /* MMC5 scanline IRQ holds the line until $5204 is read */
+  write(PPU_MASK, MASK_RENDERING);
+  write(0x5203, 0x20);
+  write(0x5204, 0x80);
+  cycles = next_event;
+  run_events();
+  assert(irq_line == 1);
+  assert(READ(0x5204) & 0x80);
+  assert(irq_line == 0 && !(READ(0x5204) & 0x80));
+
+  /* MMC5 pulse at the outputting duty step adds its volume to the PCM level,
+   * and its length counter runs out at 240Hz */
+  write(0x5015, 0x01);
+  write(0x5000, 0xDF);
+  write(0x5002, 0x10);
+  write(0x5003, 0x08);
+  write(0x5011, 0x80);
+  assert(mapper_audio() == 15 + 0x80);
+  assert(READ(0x5015) == 0x01);
+  write(0x5000, 0xDF & ~0x20);
+  write(0x5003, 0x18);
+  cycles += 3 * 7457;
+  assert(READ(0x5015) == 0 && mapper_audio() == 0x80);
+  write(0x5003, 0x08);
+  write(0x5015, 0x00);
+  assert(READ(0x5015) == 0 && mapper_audio() == 0x80);
+
+  /* VRC7: three switchable 8KB banks */
+  deinitialize_cpu();
+  initialize_cpu();
+  load_test_rom(85);
+  write(0x8000, 0x05);
+  write(0x8010, 0x06);
+  write(0x9000, 0x07);
+  assert(READ(0x8000) == 5 && READ(0xA000) == 6);
+  assert(READ(0xC000) == 7 && READ(0xE000) == 15);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_gamedb()
+{
+  /* Set up */
+  initialize_cpu();
+  size_t size = INES_HEADER_SIZE + 8 * 0x4000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 8;
+  for (int bank = 0; bank < 16; bank++)
+  {
+    rom[INES_HEADER_SIZE + bank * PRG_BANK_SIZE] = bank;
+  }
+  rom[INES_HEADER_SIZE + 1] = 0xDB;
+
+  /* Test */
+
+  /* Check value and every tail length of the byte loop */
+  assert(rom_crc32(0, (const uint8_t*) "123456789", 9) == 0xCBF43926);
+  assert(rom_crc32(0, (const uint8_t*) "", 0) == 0);
+  assert(rom_crc32(rom_crc32(0, (const uint8_t*) "1234", 4), (const uint8_t*) "56789", 5) == 0xCBF43926);
+
+  /* Every fixture entry is found in one probe, others miss */
+  assert(gamedb_lookup(0x6A2E08DD)->mapper == 4);
+  assert(gamedb_lookup(0x00000000)->mapper == 1);
+  assert(gamedb_lookup(0xFFFFFFFF)->mirroring == mirroring_four_screen);
+  assert(gamedb_lookup(0x12345678)->mapper == 7);
+  assert(gamedb_lookup(0x9ABCDEF0)->mapper == 9);
+  assert(gamedb_lookup(0xCBF43926)->mapper == 66);
+  assert(gamedb_lookup(0x12345679) == NULL);
+  assert(gamedb_lookup(0xDEADBEEF) == NULL);
+
+  /* The loader replaces the bad header before picking the board */
+  assert(load_rom(rom, size) == 0);
+  assert(cartridge.crc == 0x6A2E08DD);
+  assert(cartridge.mapper == 4 && cartridge.submapper == 1);
+  assert(cartridge.vertical_mirroring == 1 && cartridge.four_screen == 0);
+  assert(cartridge.prg_ram_size == 0x2000 && cartridge.chr_ram_size == 0x8000);
+  assert(cartridge.region == region_pal);
+  assert(mapper_write != NULL);
+
+  /* Unknown ROMs keep their header */
+  rom[INES_HEADER_SIZE + 1] = 0;
+  assert(load_rom(rom, size) == 0);
+  assert(cartridge.mapper == 0 && mapper_write == NULL);
+  assert(cartridge.region == region_ntsc && cartridge.chr_ram_size == 0x2000);
+
+  /* A shipped entry: an image with Super Mario Bros.' sizes and CRC, its
+   * last four bytes chosen to reach the CRC, under a header claiming MMC1
+   * with horizontal mirroring */
+  size_t smb_size = INES_HEADER_SIZE + 0x8000 + 0x2000;
+  uint8_t* smb = calloc(smb_size, 1);
+  memcpy(smb, "NES\x1A", 4);
+  smb[4] = 2;
+  smb[5] = 1;
+  smb[6] = 0x10;
+  memcpy(smb + smb_size - 4, "\xC0\xDB\x28\xBD", 4);
+  assert(load_rom(smb, smb_size) == 0);
+  assert(cartridge.crc == 0x3337EC46);
+  assert(cartridge.mapper == 0 && mapper_write == NULL);
+  assert(cartridge.vertical_mirroring == 1);
+  free(smb);
+
+  /* Tear down */
+  free(rom);
+  deinitialize_cpu();
+}
+
+static void put16(uint8_t* p, uint16_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t value)
+{
+  put16(p, value);
+  put16(p + 2, value >> 16);
+}
+
+/* Write a zip holding one entry, method 8 with the raw deflate stream in
+ * packed or method 0 storing the image as is */
+static void write_zip(FILE* file, const char* name, int method, const uint8_t* packed, uint32_t compressed,
+    const uint8_t* data, size_t size)
+{
+  uint16_t length = strlen(name);
+  uint8_t local[30] = {0};
+  uint8_t central[46] = {0};
+  uint8_t end[22] = {0};
+  put32(local, 0x04034B50);
+  put16(local + 8, method);
+  put32(local + 14, rom_crc32(0, data, size));
+  put32(local + 18, method ? compressed : size);
+  put32(local + 22, size);
+  put16(local + 26, length);
+  put32(central, 0x02014B50);
+  memcpy(central + 10, local + 8, 20);
+  fwrite(local, 1, 30, file);
+  fwrite(name, 1, length, file);
+  fwrite(method ? packed : data, 1, method ? compressed : size, file);
+
+  put32(end, 0x06054B50);
+  put16(end + 8, 1);
+  put16(end + 10, 1);
+  put32(end + 12, 46 + length);
+  put32(end + 16, ftell(file));
+  fwrite(central, 1, 46, file);
+  fwrite(name, 1, length, file);
+  fwrite(end, 1, 22, file);
+  rewind(file);
+}
+
+void test_zip()
+{
+  /* Set up */
+  initialize_cpu();
+  size_t size = INES_HEADER_SIZE + 2 * 0x4000 + 0x2000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 2;
+  rom[5] = 1;
+  rom[INES_HEADER_SIZE + 0x7FFC] = 0x34;
+  rom[INES_HEADER_SIZE + 0x8000] = 0x56;
+
+  /* The same image deflated by zlib at level 9 */
+  static const uint8_t packed[] = {
+    0xED, 0xD0, 0x31, 0x0D, 0x00, 0x20, 0x0C, 0x00, 0x41, 0x40, 0x06, 0x3A, 0xB0, 0xC0, 0xCA, 0xD2,
+    0x04, 0xFF, 0x52, 0x60, 0xA8, 0x89, 0x26, 0x77, 0xC9, 0x1B, 0xF8, 0xB3, 0x63, 0x8E, 0xDE, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x80, 0xB4,
+    0x7E, 0xD7, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x28, 0xEF, 0x01
+  };
+
+  FILE* deflated = tmpfile();
+  FILE* stored = tmpfile();
+  FILE* other = tmpfile();
+  write_zip(deflated, "Game (U).NES", 8, packed, sizeof(packed), rom, size);
+  write_zip(stored, "game.nes", 0, NULL, 0, rom, size);
+  write_zip(other, "readme.txt", 0, NULL, 0, rom, size);
+
+  /* Test */
+
+  /* The entry inflates into a cached image that the cartridge uses in place */
+  assert(load_zip(deflated) == 0);
+  struct rom_image* image = cartridge.image;
+  assert(image != NULL && image->size == size && image->refs == 1);
+  assert(READ(0xFFFC) == 0x34);
+  assert(cartridge.prg_rom == image->data + INES_HEADER_SIZE);
+  assert(cartridge.chr_rom[0] == 0x56);
+
+  /* Another archive with the same ROM finds the image by CRC and shares it */
+  assert(rom_cache_acquire(image->crc, size) == image);
+  assert(load_zip(stored) == 0);
+  assert(cartridge.image == image && image->refs == 2);
+  rom_cache_release(image);
+  assert(image->refs == 1);
+
+  /* Unloading drops the last reference, stored entries are read as is */
+  unload_rom();
+  assert(rom_cache_acquire(rom_crc32(0, rom, size), size) == NULL);
+  assert(load_zip(stored) == 0);
+  assert(READ(0xFFFC) == 0x34 && cartridge.chr_rom[0] == 0x56);
+
+  /* Archives without a ROM and files that are not archives fail */
+  assert(load_zip(other) == -1);
+  fclose(other);
+  other = tmpfile();
+  fwrite(rom, 1, size, other);
+  assert(load_zip(other) == -1);
+
+  /* A forged entry size is refused before anything is allocated for it */
+  fclose(other);
+  other = tmpfile();
+  write_zip(other, "big.nes", 0, NULL, 0, rom, size);
+  fseek(other, 30 + 7 + size + 24, SEEK_SET);
+  fwrite("\xF0\xFF\xFF\xFF", 1, 4, other);
+  rewind(other);
+  assert(load_zip(other) == -1);
+
+  /* So is a forged directory size, or a directory running into the end record */
+  fclose(other);
+  other = tmpfile();
+  write_zip(other, "big.nes", 0, NULL, 0, rom, size);
+  fseek(other, -22 + 12, SEEK_END);
+  fwrite("\xF0\xFF\xFF\xFF", 1, 4, other);
+  rewind(other);
+  assert(load_zip(other) == -1);
+  fseek(other, -22 + 12, SEEK_END);
+  fwrite("\x36\0\0\0", 1, 4, other);
+  rewind(other);
+  assert(load_zip(other) == -1);
+
+  /* Tear down */
+  fclose(deflated);
+  fclose(stored);
+  fclose(other);
+  free(rom);
+  deinitialize_cpu();
+}
+
+static void write_file(const char* path, const uint8_t* data, size_t size)
+{
+  FILE* file = fopen(path, "wb");
+  fwrite(data, 1, size, file);
+  fclose(file);
+}
+
+void test_library()
+{
+  /* Set up */
+  char directory[] = "/tmp/nes-library-XXXXXX";
+  char path[256];
+  char index[256];
+  assert(mkdtemp(directory) != NULL);
+  snprintf(index, sizeof(index), "%s/index", directory);
+  size_t size = INES_HEADER_SIZE + 0x4000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 1;
+  rom[6] = 0x41;
+
+  snprintf(path, sizeof(path), "%s/Alpha.nes", directory);
+  write_file(path, rom, size);
+  uint32_t alpha = rom_crc32(0, rom + INES_HEADER_SIZE, 0x4000);
+  snprintf(path, sizeof(path), "%s/sub", directory);
+  mkdir(path, 0700);
+  rom[INES_HEADER_SIZE] = 1;
+  snprintf(path, sizeof(path), "%s/sub/Beta.nes", directory);
+  write_file(path, rom, size);
+  uint32_t beta = rom_crc32(0, rom + INES_HEADER_SIZE, 0x4000);
+  snprintf(path, sizeof(path), "%s/notes.txt", directory);
+  write_file(path, rom, size);
+
+  /* Test */
+
+  /* Every ROM in the tree is indexed with its header, other files are not */
+  assert(library_open(index) == NULL);
+  assert(library_build(directory, index) == 0);
+  struct library* library = library_open(index);
+  assert(library != NULL && library->count == 2);
+  const struct library_entry* entry = library_find(library, beta);
+  assert(entry != NULL && entry->header.mapper == 4);
+  assert(entry->header.mirroring == mirroring_vertical);
+  assert(!strcmp(library_path(library, entry), "sub/Beta.nes"));
+  assert(library_find_name(library, "Alpha") == library_find(library, alpha));
+  assert(library_find_name(library, "Gamma") == NULL);
+  assert(library_find(library, alpha ^ 1) == NULL);
+  library_close(library);
+
+  /* Unchanged files keep their records, changed ones are read again */
+  struct stat info;
+  snprintf(path, sizeof(path), "%s/sub/Beta.nes", directory);
+  stat(path, &info);
+  struct utimbuf times = {info.st_atime, info.st_mtime};
+  rom[INES_HEADER_SIZE] = 2;
+  write_file(path, rom, size);
+  utime(path, &times);
+  snprintf(path, sizeof(path), "%s/Alpha.nes", directory);
+  write_file(path, rom, size - 1);
+  assert(library_build(directory, index) == 0);
+  library = library_open(index);
+  assert(library->count == 1);
+  assert(library_find(library, beta) != NULL);
+  assert(library_find_name(library, "Alpha") == NULL);
+  library_close(library);
+
+  /* A symlink back up the tree is scanned once */
+  snprintf(path, sizeof(path), "ln -s .. %s/sub/loop", directory);
+  assert(system(path) == 0);
+  assert(library_build(directory, index) == 0);
+  library = library_open(index);
+  assert(library->count == 1);
+  library_close(library);
+
+  /* An index whose strings point past the file is refused */
+  FILE* file = fopen(index, "r+b");
+  uint32_t offset = 0xFFFFFFF0;
+  fseek(file, sizeof(struct library_header) + offsetof(struct library_entry, path), SEEK_SET);
+  fwrite(&offset, sizeof(offset), 1, file);
+  fclose(file);
+  assert(library_open(index) == NULL);
+
+  /* Tear down */
+  snprintf(path, sizeof(path), "rm -rf %s", directory);
+  assert(system(path) == 0);
+  free(rom);
+}
+
+void test_region()
+{
+  /* Set up */
+  initialize_cpu();
+  memory[0x8000] = 0x4C;
+  memory[0x8001] = 0x00;
+  memory[0x8002] = 0x80;
+  memory[0x9000] = 0x4C;
+  memory[0x9001] = 0x00;
+  memory[0x9002] = 0x90;
+  memory[NMI_VECTOR] = 0x00;
+  memory[NMI_VECTOR + 1] = 0x90;
+
+  /* Test */
+
+  /* NTSC: 262 lines of 341 dots at 3 dots a cycle, NMI at vblank */
+  assert(timing->region == region_ntsc);
+  pc = 0x8000;
+  write(PPU_CTRL, CTRL_NMI);
+  run_frame();
+  assert(frame_count == 1);
+  assert(cycles * 3 >= DOTS_PER_FRAME && (cycles - 10) * 3 < DOTS_PER_FRAME);
+  assert(pc == 0x9000);
+  run_frame();
+  assert(frame_count == 2 && cycles * 3 >= 2 * DOTS_PER_FRAME);
+
+  /* Hours in, the cycle count has passed what an int holds */
+  frame_count = 200000;
+  cycles = frame_count * DOTS_PER_FRAME / 3;
+  pc = 0x8000;
+  run_frame();
+  assert(cycles > INT_MAX && frame_count == 200001);
+  assert(cycles * 3 >= 200001LL * DOTS_PER_FRAME && (cycles - 10) * 3 < 200001LL * DOTS_PER_FRAME);
+  assert(pc == 0x9000);
+
+  /* PAL: 312 lines at 3.2 dots a cycle and its own DMC periods */
+  set_region(region_pal);
+  cycles = 0;
+  frame_count = 0;
+  pc = 0x8000;
+  write(0x4010, 0x00);
+  assert(dmc.period == 398);
+  run_frame();
+  assert(cycles * 16 >= PAL_SCANLINES * DOTS_PER_SCANLINE * 5);
+  assert((cycles - 10) * 16 < PAL_SCANLINES * DOTS_PER_SCANLINE * 5);
+  assert(pc == 0x9000);
+  assert(clock_dot(5) == 16 && dot_clock(17) == 6);
+
+  /* Dendy: PAL's frame at NTSC's ratio */
+  set_region(region_dendy);
+  cycles = 0;
+  frame_count = 0;
+  pc = 0x8000;
+  run_frame();
+  assert(cycles * 3 >= PAL_SCANLINES * DOTS_PER_SCANLINE);
+
+  /* The header's PAL bit picks the region when a ROM loads */
+  size_t size = INES_HEADER_SIZE + 0x4000;
+  uint8_t* rom = calloc(size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 1;
+  rom[9] = 1;
+  assert(load_rom(rom, size) == 0);
+  assert(timing->region == region_pal);
+  rom[9] = 0;
+  assert(load_rom(rom, size) == 0);
+  assert(timing->region == region_ntsc);
+
+  /* Tear down */
+  free(rom);
+  deinitialize_cpu();
+}
+
+void test_overclock()
+{
+  /* Set up */
+  initialize_cpu();
+  memory[0x8000] = 0x4C;
+  memory[0x8001] = 0x00;
+  memory[0x8002] = 0x80;
+  memory[0x9000] = 0x4C;
+  memory[0x9001] = 0x00;
+  memory[0x9002] = 0x90;
+  memory[NMI_VECTOR + 1] = 0x90;
+  pc = 0x8000;
+  write(PPU_CTRL, CTRL_NMI);
+  int extra = (20 * DOTS_PER_SCANLINE + 2) / 3;
+  int vblank_cycle = (NTSC_VBLANK_SCANLINE * DOTS_PER_SCANLINE + 1 + 2) / 3;
+
+  /* Test */
+
+  /* 20 extra lines after NMI, the frame is that much longer for the CPU */
+  set_overclock(20, overclock_vblank);
+  run_frame();
+  assert(pc == 0x9000);
+  assert(overclock_cycles == extra);
+  assert((cycles - extra) * 3 >= DOTS_PER_FRAME && (cycles - extra - 10) * 3 < DOTS_PER_FRAME);
+
+  /* The system clock stands still through the window, which opens once the
+   * NMI has been taken */
+  int frozen = system_clock(vblank_cycle + 100);
+  assert(system_clock(1000) == 1000);
+  assert(frozen >= vblank_cycle && frozen < vblank_cycle + 12);
+  assert(system_clock(vblank_cycle + 200) == frozen);
+  assert(system_clock(frozen + extra + 10) == frozen + 10);
+  assert(clock_cycle(system_clock(cycles)) == cycles);
+
+  /* Events due after the window start wait for it to end */
+  schedule_event(cycles + 100, vblank);
+  overclock();
+  assert(next_event == cycles + 100 + extra);
+  cancel_event(vblank);
+
+  /* After rendering ends, and off again */
+  set_overclock(20, overclock_post_render);
+  long long before = overclock_cycles;
+  run_frame();
+  assert(overclock_cycles == before + extra);
+  set_overclock(0, overclock_vblank);
+  run_frame();
+  assert(overclock_cycles == before + extra);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_input()
+{
+  /* Set up */
+  initialize_cpu();
+  memory[0x8000] = 0x4C;
+  memory[0x8001] = 0x00;
+  memory[0x8002] = 0x80;
+  /* NMI handler polling port 1: LDA $4016, JMP $9000 */
+  memory[0x9000] = 0xAD;
+  memory[0x9001] = 0x16;
+  memory[0x9002] = 0x40;
+  memory[0x9003] = 0x4C;
+  memory[0x9004] = 0x00;
+  memory[0x9005] = 0x90;
+  memory[NMI_VECTOR + 1] = 0x90;
+  pc = 0x8000;
+
+  /* Test */
+
+  /* Strobe latches the buttons, reads shift them out A first, then 1s */
+  input_buttons[0] = BUTTON_A | BUTTON_START | BUTTON_RIGHT;
+  input_buttons[1] = BUTTON_B;
+  write(INPUT_STROBE, 1);
+  assert(READ(INPUT_PORT1) == 0x41 && READ(INPUT_PORT1) == 0x41);
+  write(INPUT_STROBE, 0);
+  uint8_t expected[9] = {1, 0, 0, 1, 0, 0, 0, 1, 1};
+  for (int bit = 0; bit < 9; bit++)
+  {
+    assert((READ(INPUT_PORT1) & 0x01) == expected[bit]);
+  }
+  assert((READ(INPUT_PORT2) & 0x01) == 0 && (READ(INPUT_PORT2) & 0x01) == 1);
+  assert(input_current.strobes == 1);
+  assert(input_current.reads[0] == 11 && input_current.reads[1] == 2);
+
+  /* Frames that never read the ports are lag frames */
+  input_current.reads[0] = 0;
+  input_current.reads[1] = 0;
+  assert(run_input_frame(3) == 3);
+  assert(input_last.lag == 1 && lag_frames == 3);
+
+  /* The NMI handler polls, so the next frame is not lag */
+  write(PPU_CTRL, CTRL_NMI);
+  assert(run_input_frame(5) == 1);
+  assert(input_last.lag == 0 && input_last.reads[0] > 0);
+  assert(lag_frames == 3);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+/* NROM-128 whose NMI handler counts frames in $10 and frames with A held
+ * on controller 1 in $11 */
+static uint8_t* counter_rom(size_t* size)
+{
+  static const uint8_t program[] = {
+    0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x05, 0x80,
+    0xE6, 0x10, 0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00, 0x8D, 0x16, 0x40,
+    0xAD, 0x16, 0x40, 0x29, 0x01, 0x18, 0x65, 0x11, 0x85, 0x11, 0x40
+  };
+  *size = INES_HEADER_SIZE + 0x4000;
+  uint8_t* rom = calloc(*size, 1);
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 1;
+  memcpy(rom + INES_HEADER_SIZE, program, sizeof(program));
+  rom[INES_HEADER_SIZE + 0x3FFA] = 0x08;
+  rom[INES_HEADER_SIZE + 0x3FFB] = 0x80;
+  rom[INES_HEADER_SIZE + 0x3FFC] = 0x00;
+  rom[INES_HEADER_SIZE + 0x3FFD] = 0x80;
+  return rom;
+}
+
+void test_vector()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct vector* vector = vector_create(3, rom, size, 0);
+  assert(vector != NULL);
+  assert(vector_add_reward(vector, (struct reward_term) {0x11, reward_delta, 0, 1.0f}) == 0);
+  assert(vector_add_done(vector, (struct done_term) {0x10, 0xFF, 5}) == 0);
+  uint8_t actions[3] = {BUTTON_A, 0, BUTTON_A};
+  float rewards[3];
+  uint8_t dones[3];
+  struct input_frame frames[3];
+
+  /* Test */
+
+  /* Each action is held for the repeat count, rewards come from RAM */
+  vector_step(vector, actions, 2, rewards, dones, frames);
+  assert(rewards[0] == 2 && rewards[1] == 0 && rewards[2] == 2);
+  assert(!dones[0] && !dones[1] && !dones[2]);
+  assert(frames[1].strobes == 1 && frames[1].reads[0] == 1 && !frames[1].lag);
+
+  /* Instances keep their own machines */
+  vector_switch(vector, -1, 0);
+  assert(memory[0x11] == 2 && frame_count == 2);
+  vector_switch(vector, 0, 1);
+  assert(memory[0x11] == 0 && frame_count == 2);
+  vector_switch(vector, 1, -1);
+
+  /* The fifth frame ends the episode and resets to the boot snapshot */
+  vector_step(vector, actions, 2, rewards, dones, frames);
+  vector_step(vector, actions, 2, rewards, dones, NULL);
+  assert(rewards[0] == 1 && rewards[1] == 0);
+  assert(dones[0] && dones[1] && dones[2]);
+  vector_switch(vector, -1, 2);
+  assert(memory[0x10] == 0 && memory[0x11] == 0 && frame_count == 0);
+  vector_switch(vector, 2, -1);
+
+  /* Tear down */
+  vector_destroy(vector);
+  free(rom);
+}
+
+void test_vector_async()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct vector* vector = vector_create(4, rom, size, 0);
+  vector_add_reward(vector, (struct reward_term) {0x11, reward_delta, 0, 1.0f});
+  int envs[4] = {3, 2, 1, 0};
+  uint8_t actions[4] = {BUTTON_A, 0, BUTTON_A, 0};
+  int seen = 0;
+
+  /* Test */
+
+  /* Nothing in flight */
+  assert(vector_wait(vector) == -1);
+
+  /* Every queued instance comes back once, with its own outcome */
+  assert(vector_step_async(vector, envs, actions, 4, 3) == 0);
+  assert(vector_step_async(vector, envs, actions, 1, 3) == -1);
+  for (int index = 0; index < 4; index++)
+  {
+    int env = vector_wait(vector);
+    assert(env >= 0 && env < 4 && !(seen & (1 << env)));
+    seen |= 1 << env;
+    assert(vector->results[env].reward == (env & 1 ? 3 : 0));
+    assert(!vector->results[env].done && vector->results[env].frame.strobes == 1);
+  }
+  assert(vector_wait(vector) == -1);
+
+  /* Ids out of range or listed twice queue nothing */
+  int bad[3] = {1, 4, 2};
+  assert(vector_step_async(vector, bad, actions, 3, 1) == -1);
+  bad[1] = -1;
+  assert(vector_step_async(vector, bad, actions, 3, 1) == -1);
+  bad[1] = 2;
+  assert(vector_step_async(vector, bad, actions, 3, 1) == -1);
+  assert(vector_wait(vector) == -1);
+
+  /* Finished instances can be queued again */
+  assert(vector_step_async(vector, envs + 3, actions, 1, 1) == 0);
+  assert(vector_wait(vector) == 0 && vector->results[0].reward == 1);
+
+  /* Two vectors' workers and the calling thread take turns in the globals */
+  struct vector* other = vector_create(4, rom, size, 0);
+  vector_add_reward(other, (struct reward_term) {0x11, reward_delta, 0, 1.0f});
+  assert(vector_step_async(vector, envs, actions, 3, 100) == 0);
+  assert(vector_step_async(other, envs, actions, 4, 100) == 0);
+  for (int step = 0; step < 20; step++)
+  {
+    vector_switch(vector, -1, 0);
+    assert(frame_count == 4 + step && memory[0x20] == step);
+    memory[0x20]++;
+    run_frame();
+    vector_switch(vector, 0, -1);
+  }
+  for (int index = 0; index < 3; index++)
+  {
+    int env = vector_wait(vector);
+    assert(vector->results[env].reward == (env & 1 ? 100 : 0));
+  }
+  for (int index = 0; index < 4; index++)
+  {
+    int env = vector_wait(other);
+    assert(other->results[env].reward == (env & 1 ? 100 : 0));
+  }
+  vector_switch(other, -1, 3);
+  assert(frame_count == 100 && memory[0x10] == 100 && memory[0x11] == 100);
+  vector_switch(other, 3, -1);
+  vector_destroy(other);
+
+  /* Tear down */
+  vector_destroy(vector);
+  free(rom);
+}
+
+void test_watchdog()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct vector* vector = vector_create(3, rom, size, 0);
+  uint8_t actions[3] = {0};
+  float rewards[3];
+  uint8_t dones[3];
+
+  /* Instance 1 runs into STP in RAM */
+  vector_switch(vector, -1, 1);
+  memory[0x0300] = 0x02;
+  pc = 0x0300;
+  vector_switch(vector, 1, -1);
+
+  /* Test */
+
+  /* A jam stops the instance at the end of that frame and nothing else */
+  vector_step(vector, actions, 3, rewards, dones, NULL);
+  assert(!vector->stuck[0] && vector->stuck[1] && !vector->stuck[2]);
+  vector_switch(vector, -1, 1);
+  assert(jammed && pc == 0x0300 && frame_count == 1 && memory[0x10] == 0);
+  vector_switch(vector, 1, 2);
+  assert(frame_count == 3 && memory[0x10] == 3);
+  vector_switch(vector, 2, -1);
+
+  /* Left jammed, it is not run again */
+  vector_step(vector, actions, 3, rewards, dones, NULL);
+  vector_switch(vector, -1, 1);
+  assert(frame_count == 1);
+  vector_switch(vector, 1, -1);
+
+  /* or goes back to its boot snapshot */
+  vector->reset_stuck = 1;
+  vector_step(vector, actions, 1, rewards, dones, NULL);
+  assert(vector->stuck[1]);
+  vector_switch(vector, -1, 1);
+  assert(!jammed && frame_count == 0 && pc == 0x8000);
+  vector_switch(vector, 1, -1);
+
+  /* Instance 2 hangs in a loop with interrupts and NMI off. It is caught
+   * once it has gone stall_frames frames without progress, while healthy
+   * instances run on however long the step. */
+  vector->reset_stuck = 0;
+  vector->stall_frames = 3;
+  vector_switch(vector, -1, 2);
+  long long hung = frame_count;
+  write(PPU_CTRL, 0);
+  memory[0x0300] = 0x78;
+  memory[0x0301] = 0x4C;
+  memory[0x0302] = 0x01;
+  memory[0x0303] = 0x03;
+  pc = 0x0300;
+  vector_switch(vector, 2, -1);
+  vector_step(vector, actions, 10, rewards, dones, NULL);
+  assert(!vector->stuck[0] && !vector->stuck[1] && vector->stuck[2]);
+  vector_switch(vector, -1, 0);
+  assert(frame_count == 3 + 3 + 1 + 10);
+  vector_switch(vector, 0, 2);
+  assert(frame_count == hung + 4 && pc == 0x0301);
+  vector_switch(vector, 2, -1);
+
+  /* and with reset_stuck goes back to boot, to run normally from there */
+  vector->reset_stuck = 1;
+  vector_step(vector, actions, 10, rewards, dones, NULL);
+  assert(vector->stuck[2]);
+  vector_step(vector, actions, 10, rewards, dones, NULL);
+  assert(!vector->stuck[0] && !vector->stuck[1] && !vector->stuck[2]);
+  vector_switch(vector, -1, 2);
+  assert(frame_count == 10 && memory[0x10] == 10);
+  vector_switch(vector, 2, -1);
+
+  /* Tear down */
+  vector_destroy(vector);
+  free(rom);
+}
+
+void test_vector_state()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct vector* vector = vector_create(130, rom, size, 0);
+  uint8_t* saved = malloc(vector_state_size(vector));
+  uint8_t* single = malloc(vector->snapshot_size);
+  uint8_t actions[130] = {0};
+  float rewards[130];
+  uint8_t dones[130];
+  actions[129] = BUTTON_A;
+
+  /* Test */
+
+  /* One record per instance, the same as a snapshot of it swapped in */
+  assert(vector_state_size(vector) == 130 * vector->snapshot_size);
+  vector_step(vector, actions, 2, rewards, dones, NULL);
+  vector_save_all(vector, saved);
+  vector_switch(vector, -1, 129);
+  state_save(single, STATE_SNAPSHOT);
+  vector_switch(vector, 129, -1);
+  assert(!memcmp(single, saved + 129 * vector->snapshot_size, vector->snapshot_size));
+
+  /* Restoring puts every instance back */
+  vector_step(vector, actions, 2, rewards, dones, NULL);
+  vector_restore_all(vector, saved);
+  vector_switch(vector, -1, 129);
+  assert(memory[0x10] == 2 && memory[0x11] == 2 && frame_count == 2);
+  vector_switch(vector, 129, 0);
+  assert(memory[0x10] == 2 && memory[0x11] == 0 && frame_count == 2);
+  vector_switch(vector, 0, -1);
+
+  /* A record restores into another instance, which keeps its own RAM */
+  memcpy(saved, saved + 129 * vector->snapshot_size, vector->snapshot_size);
+  vector_restore_all(vector, saved);
+  vector_switch(vector, -1, 0);
+  assert(memory[0x11] == 2 && read_pages[0] == memory && read_pages[0x80] == cartridge.prg_rom);
+  vector_switch(vector, 0, -1);
+  vector_step(vector, actions, 1, rewards, dones, NULL);
+  vector_switch(vector, -1, 0);
+  assert(memory[0x10] == 3 && memory[0x11] == 2);
+  vector_switch(vector, 0, 129);
+  assert(memory[0x10] == 3 && memory[0x11] == 3);
+  vector_switch(vector, 129, -1);
+  vector_destroy(vector);
+
+  /* and the banks it had switched in come back as offsets into the ROM of
+   * the instance it loads into */
+  size = INES_HEADER_SIZE + 8 * 0x4000 + 0x2000;
+  uint8_t* mmc3 = calloc(size, 1);
+  memcpy(mmc3, "NES\x1A", 4);
+  mmc3[4] = 8;
+  mmc3[5] = 1;
+  mmc3[6] = 0x40;
+  for (int bank = 0; bank < 16; bank++)
+  {
+    mmc3[INES_HEADER_SIZE + bank * PRG_BANK_SIZE] = bank;
+  }
+  vector = vector_create(2, mmc3, size, 0);
+  vector_switch(vector, -1, 0);
+  write(0x8000, 6);
+  write(0x8001, 3);
+  write(0x8000, 0);
+  write(0x8001, 2);
+  assert(READ(0x8000) == 3);
+  state_save(single, STATE_SNAPSHOT);
+  vector_switch(vector, 0, 1);
+  assert(READ(0x8000) == 0);
+  state_load(single, STATE_SNAPSHOT);
+  assert(READ(0x8000) == 3 && read_pages[0] == memory);
+  assert(cartridge.chr_banks[0] == cartridge.chr_rom + 2 * CHR_BANK_SIZE);
+  assert(timing->region == region_ntsc);
+  vector_switch(vector, 1, -1);
+
+  /* Tear down */
+  vector_destroy(vector);
+  free(mmc3);
+  free(saved);
+  free(single);
+  free(rom);
+}
+
+void test_workers()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct workers* workers = workers_create(4, 2, rom, size, 0);
+  assert(workers != NULL);
+  workers_add_reward(workers, (struct reward_term) {0x11, reward_delta, 0, 1.0f});
+  assert(workers_start(workers) == 0);
+  uint8_t actions[4] = {BUTTON_A, 0, 0, BUTTON_A};
+  float rewards[4];
+  uint8_t dones[4];
+  struct input_frame frames[4];
+
+  /* Test */
+
+  /* Each worker steps its own share of the instances */
+  assert(workers_step(workers, actions, 2, rewards, dones, frames) == 0);
+  assert(rewards[0] == 2 && rewards[1] == 0 && rewards[2] == 0 && rewards[3] == 2);
+  assert(!dones[0] && !dones[3] && frames[3].strobes == 1);
+
+  /* A crashed worker ends its instances' episodes and nothing else */
+  kill(workers->workers[0].pid, SIGKILL);
+  assert(workers_step(workers, actions, 1, rewards, dones, frames) == 1);
+  assert(dones[0] && dones[1] && !dones[2] && !dones[3] && rewards[3] == 1);
+
+  /* and comes back from boot */
+  assert(workers_step(workers, actions, 1, rewards, dones, NULL) == 0);
+  assert(rewards[0] == 1 && !dones[0] && rewards[3] == 1);
+
+  /* Not an iNES image, or a mapper that does not load */
+  assert(workers_create(1, 1, rom + 1, size - 1, 0) == NULL);
+  rom[6] = 0x70;
+  assert(workers_create(1, 1, rom, size, 0) == NULL);
+  rom[6] = 0;
+  workers_destroy(workers);
+
+  /* The watchdog runs in the workers. Every instance hangs in SEI, JMP to
+   * itself from reset, with NMI never enabled. */
+  rom[INES_HEADER_SIZE + 0x100] = 0x78;
+  rom[INES_HEADER_SIZE + 0x101] = 0x4C;
+  rom[INES_HEADER_SIZE + 0x102] = 0x01;
+  rom[INES_HEADER_SIZE + 0x103] = 0x81;
+  rom[INES_HEADER_SIZE + 0x3FFC] = 0x00;
+  rom[INES_HEADER_SIZE + 0x3FFD] = 0x81;
+  workers = workers_create(4, 2, rom, size, 0);
+  workers->stall_frames = 3;
+  assert(workers_start(workers) == 0);
+  assert(workers_step(workers, actions, 10, rewards, dones, NULL) == 0);
+  assert(workers->stuck[0] && workers->stuck[1] && workers->stuck[2] && workers->stuck[3]);
+
+  /* Tear down */
+  workers_destroy(workers);
+  free(rom);
+}
+
+void test_cheats()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct cheat cheat;
+  initialize_cpu();
+  load_rom(rom, size);
+  pc = ADDR_16(RESET_VECTOR);
+  uint8_t* snapshot = malloc(state_size(STATE_SNAPSHOT));
+  state_save(snapshot, STATE_SNAPSHOT);
+
+  /* Test */
+
+  /* Game Genie codes */
+  assert(cheat_game_genie("SXIOPO", &cheat) == 0);
+  assert(cheat.address == 0x91D9 && cheat.value == 0xAD && cheat.compare == CHEAT_NO_COMPARE);
+  assert(cheat_game_genie("sxiopo", &cheat) == 0 && cheat.address == 0x91D9);
+  assert(cheat_game_genie("SXIOP1", &cheat) == -1 && cheat_game_genie("SXIOPOA", &cheat) == -1);
+  assert(cheat_game_genie("AAAAAAAA", &cheat) == 0 && cheat.compare == 0);
+
+  /* A ROM code moves only its own page onto a patched copy */
+  assert(cheat_add((struct cheat) {0x8000, 0xEA, cheat_rom, 0xA9}) == 0);
+  assert(cheat_add((struct cheat) {0x8001, 0x00, cheat_rom, 0x12}) == 0);
+  assert(read_pages[0x80] != cartridge.prg_rom && read_pages[0x81] == cartridge.prg_rom + 0x100);
+  assert(READ(0x8000) == 0xEA && READ(0x8001) == 0x80 && READ(0xC000) == 0xA9);
+
+  /* and is applied again after a bank switch */
+  map_prg(0, 0);
+  assert(READ(0x8000) == 0xEA);
+
+  /* Codes belong to the instance, loading a snapshot from before them
+   * keeps them applied */
+  state_load(snapshot, STATE_SNAPSHOT);
+  assert(READ(0x8000) == 0xEA && READ(0xC000) == 0xA9);
+  cheat_clear();
+  assert(read_pages[0x80] == cartridge.prg_rom && READ(0x8000) == 0xA9);
+  assert(cheat_add((struct cheat) {0x1234, 0, cheat_rom, CHEAT_NO_COMPARE}) == -1);
+
+  /* Action Replay codes freeze RAM as each frame ends */
+  assert(cheat_action_replay("00107F", &cheat) == 0);
+  assert(cheat.address == 0x0010 && cheat.value == 0x7F && cheat.kind == cheat_freeze);
+  assert(cheat_action_replay("0010G0", &cheat) == -1);
+  cheat_add(cheat);
+  run_frame();
+  run_frame();
+  assert(memory[0x10] == 0x7F);
+
+  /* Tear down */
+  deinitialize_cpu();
+  free(snapshot);
+  free(rom);
+}
+
+struct hook_log
+{
+  int calls;
+  int count;
+  struct hook_event last;
+};
+
+static void log_access(struct hook_event event, void* user)
+{
+  struct hook_log* log = user;
+  log->calls++;
+  log->count++;
+  log->last = event;
+}
+
+static void log_batch(const struct hook_event* events, int count, void* user)
+{
+  struct hook_log* log = user;
+  log->calls++;
+  log->count += count;
+  log->last = events[count - 1];
+}
+
+void test_hooks()
+{
+  /* Set up */
+  size_t size;
+  uint8_t* rom = counter_rom(&size);
+  struct hook_log writes = {0};
+  struct hook_log reads = {0};
+  struct hook_log rom_reads = {0};
+  initialize_cpu();
+  load_rom(rom, size);
+  pc = ADDR_16(RESET_VECTOR);
+  uint8_t* snapshot = malloc(state_size(STATE_SNAPSHOT));
+  state_save(snapshot, STATE_SNAPSHOT);
+
+  /* Test */
+
+#ifdef HOOKS
+  /* Only hooked pages leave the direct path */
+  int write_hook = hook_add((struct hook) {0x0010, 0x0010, hook_write, log_access, NULL, &writes});
+  int read_hook = hook_add((struct hook) {0x0011, 0x0011, hook_read, NULL, log_batch, &reads});
+  assert(write_hook >= 0 && read_hook >= 0);
+  assert(read_pages[0x00] == NULL && hook_pages[0x00] == memory && read_pages[0x01] == memory + 0x100);
+
+  /* The NMI handler writes $10 and reads $11 once a frame. Writes are
+   * delivered at once, deferred reads in one batch as the frame ends. */
+  run_frame();
+  run_frame();
+  assert(writes.count == 2 && writes.last.address == 0x0010 && writes.last.value == memory[0x10]);
+  assert(writes.last.kind == hook_write);
+  assert(reads.calls == 2 && reads.count == 2 && reads.last.address == 0x0011);
+
+  /* A ROM range stays hooked through bank switches and cheats */
+  int rom_hook = hook_add((struct hook) {0x8000, 0x800F, hook_read, log_access, NULL, &rom_reads});
+  assert(read_pages[0x80] == NULL && read_pages[0x81] == cartridge.prg_rom + 0x100);
+  assert(READ(0x8000) == 0xA9 && rom_reads.count == 1 && rom_reads.last.value == 0xA9);
+  READ(0x8010);
+  assert(rom_reads.count == 1);
+  map_prg(0, 0);
+  assert(read_pages[0x80] == NULL && READ(0x8001) == 0x80 && rom_reads.count == 2);
+  cheat_add((struct cheat) {0x8000, 0xEA, cheat_rom, CHEAT_NO_COMPARE});
+  assert(read_pages[0x80] == NULL && READ(0x8000) == 0xEA && rom_reads.last.value == 0xEA);
+  cheat_clear();
+  assert(READ(0x8000) == 0xA9);
+
+  /* Hooks belong to the instance, loading a snapshot from before them
+   * keeps them and their pages off the direct path */
+  state_load(snapshot, STATE_SNAPSHOT);
+  assert(read_pages[0x80] == NULL && hook_pages[0x80] == cartridge.prg_rom && read_pages[0x00] == NULL);
+  assert(READ(0x8000) == 0xA9 && rom_reads.count == 5);
+
+  /* A batch hook removed partway through a frame gets none of its
+   * accesses, nor does a hook given its id */
+  struct hook_log dropped = {0};
+  struct hook_log reused = {0};
+  int batch_hook = hook_add((struct hook) {0x0012, 0x0012, hook_read, NULL, log_batch, &dropped});
+  READ(0x0012);
+  READ(0x0012);
+  hook_remove(batch_hook);
+  assert(hook_add((struct hook) {0x0012, 0x0012, hook_read, NULL, log_batch, &reused}) == batch_hook);
+  READ(0x0012);
+  hook_end_frame();
+  assert(dropped.calls == 0 && reused.calls == 1 && reused.count == 1);
+  hook_remove(batch_hook);
+  hook_remove(-1);
+  hook_remove(HOOK_MAX);
+  assert(hook_add((struct hook) {0x0012, 0x0012, hook_read, NULL, NULL, NULL}) == -1);
+
+  /* Removing the last hook on a page puts it back */
+  hook_remove(rom_hook);
+  hook_remove(read_hook);
+  assert(read_pages[0x80] == cartridge.prg_rom && read_pages[0x00] == memory);
+  hook_remove(write_hook);
+  run_frame();
+  assert(writes.count == 2 && reads.count == 2);
+
+  /* Registers on the input page still read through */
+  hook_add((struct hook) {INPUT_PORT1, INPUT_PORT1, hook_read, log_access, NULL, &reads});
+  input_buttons[0] = 0x01;
+  write(INPUT_STROBE, 1);
+  write(INPUT_STROBE, 0);
+  assert(READ(INPUT_PORT1) == 0x41 && reads.last.value == 0x41);
+#endif
+
+  /* Tear down */
+  deinitialize_cpu();
+  free(snapshot);
+  free(rom);
+}
+
+void test_diff()
+{
+  /* Set up */
+  uint8_t before[40] = {0};
+  uint8_t after[40] = {0};
+  struct state_change changes[4];
+  uint8_t frames[300][20] = {{0}};
+  uint8_t signal[300] = {0};
+  uint32_t agree[20];
+  uint8_t* snapshot;
+  initialize_cpu();
+  after[3] = 1;
+  after[17] = 2;
+  before[38] = 3;
+
+  /* Test */
+
+  /* Changes across whole blocks and the tail, in order */
+  assert(state_diff(before, after, 40, changes, 4) == 3);
+  assert(changes[0].offset == 3 && changes[0].before == 0 && changes[0].after == 1);
+  assert(changes[1].offset == 17 && changes[1].after == 2);
+  assert(changes[2].offset == 38 && changes[2].before == 3 && changes[2].after == 0);
+  assert(state_diff(before, after, 40, changes, 1) == 3 && changes[0].offset == 3);
+  assert(state_diff(before, before, 40, changes, 4) == 0);
+
+  /* Byte 5 moves with the signal, byte 18 every frame, byte 6 never */
+  for (int frame = 1; frame < 300; frame++)
+  {
+    signal[frame] = frame % 3 == 0;
+    memcpy(frames[frame], frames[frame - 1], 20);
+    frames[frame][5] += signal[frame];
+    frames[frame][18]++;
+  }
+  diff_lockstep(frames[0], 20, 300, 20, signal, agree);
+  assert(agree[5] == 299 && agree[18] == 99 && agree[6] == 200);
+
+  /* RAM and OAM within a snapshot */
+  snapshot = malloc(state_size(STATE_SNAPSHOT));
+  memory[0x0123] = 0x45;
+  oam[7] = 0x89;
+  state_save(snapshot, STATE_SNAPSHOT);
+  assert(snapshot[state_offset(&memory) + 0x0123] == 0x45);
+  assert(snapshot[state_offset(oam) + 7] == 0x89);
+
+  /* Tear down */
+  free(snapshot);
+  deinitialize_cpu();
+}
+
+void test_search()
+{
+  /* Set up */
+  struct ram_search search;
+  size_t stride = state_size(STATE_SNAPSHOT);
+  size_t ram = state_offset(&memory);
+  uint8_t* frames = calloc(600, stride);
+  uint16_t addresses[4];
+
+  /* $0042 counts up by 2 each frame, $6010 counts down, $0100 holds 7 */
+  for (int frame = 0; frame < 600; frame++)
+  {
+    uint8_t* snapshot = frames + frame * stride + ram;
+    snapshot[0x0042] = frame * 2 + 1;
+    snapshot[0x6010] = 200 - frame % 100;
+    snapshot[0x0100] = 7;
+    snapshot[0x0300] = frame % 2;
+  }
+
+  /* Test */
+
+  /* Everything starts out a candidate */
+  search_reset(&search);
+  assert(search_count(&search) == SEARCH_BYTES);
+
+  /* Filters over consecutive frames */
+  search_filter(&search, frames, frames + stride, stride, 99, search_changed, 0);
+  assert(search_count(&search) == 3);
+  search_filter(&search, frames, frames + stride, stride, 599, search_delta, 2);
+  assert(search_results(&search, addresses, 4) == 1 && addresses[0] == 0x0042);
+
+  search_reset(&search);
+  search_filter(&search, frames, frames + stride, stride, 99, search_decreased, 0);
+  assert(search_results(&search, addresses, 4) == 1 && addresses[0] == 0x6010);
+
+  search_reset(&search);
+  search_filter(&search, frames, frames, stride, 600, search_equal, 7);
+  assert(search_results(&search, addresses, 4) == 1 && addresses[0] == 0x0100);
+
+  /* Pairs far apart, like two instances' snapshots */
+  search_reset(&search);
+  search_filter(&search, frames, frames + 300 * stride, stride, 300, search_unchanged, 0);
+  assert(search_count(&search) == SEARCH_BYTES - 1);
+  search_filter(&search, frames, frames + stride, stride, 1, search_changed, 0);
+  assert(search_results(&search, addresses, 4) == 2);
+  assert(addresses[0] == 0x0300 && addresses[1] == 0x6010);
+
+  /* Tear down */
+  free(frames);
+}
+
+void test_cdl()
+{
+  /* Set up */
+  size_t size = INES_HEADER_SIZE + 8 * 0x4000 + 0x2000;
+  uint8_t* rom = calloc(size, 1);
+  uint8_t* prg = rom + INES_HEADER_SIZE;
+  memcpy(rom, "NES\x1A", 4);
+  rom[4] = 8;
+  rom[5] = 1;
+  rom[6] = 0x40;
+  prg[5 * PRG_BANK_SIZE] = 0x0D;
+  prg[5 * PRG_BANK_SIZE + 1] = 0x10;
+  prg[5 * PRG_BANK_SIZE + 2] = 0xA0;
+  prg[6 * PRG_BANK_SIZE + 0x10] = 0x01;
+  initialize_cpu();
+  load_rom(rom, size);
+  cdl_reset();
+
+  /* Test */
+
+  /* The log is as long as the ROM */
+  assert(cdl_prg_size == 8 * 0x4000 && cdl_chr_size == 0x2000);
+
+#ifdef CDL
+  /* MMC3 banks 5 and 6 at $8000 and $A000. ORA absolute marks the opcode,
+   * its operand and the data it reads at their ROM offsets. */
+  write(0x8000, 6);
+  write(0x8001, 5);
+  write(0x8000, 7);
+  write(0x8001, 6);
+  pc = 0x8000;
+  perform_instruction(READ(0x8000), 0x8000);
+  assert(accumulator == 0x01);
+  assert(cdl_prg[5 * PRG_BANK_SIZE] == CDL_CODE);
+  assert(cdl_prg[5 * PRG_BANK_SIZE + 1] == (CDL_CODE | CDL_OPERAND));
+  assert(cdl_prg[5 * PRG_BANK_SIZE + 2] == (CDL_CODE | CDL_OPERAND));
+  assert(cdl_prg[6 * PRG_BANK_SIZE + 0x10] == CDL_DATA);
+  assert(cdl_prg[0x0000] == 0 && cdl_prg[0x2010] == 0);
+
+  /* Another bank at the same address is logged at its own offset */
+  write(0x8000, 6);
+  write(0x8001, 2);
+  READ(0x8004);
+  assert(cdl_prg[2 * PRG_BANK_SIZE + 4] == CDL_DATA && cdl_prg[5 * PRG_BANK_SIZE + 4] == 0);
+
+  /* RAM at $6000 is not logged */
+  READ(0x6000);
+#endif
+
+  /* Save and merge back into a cleared log, PRG then CHR */
+  cdl_prg[cdl_prg_size - 1] = CDL_DATA;
+  cdl_chr[0x0100] = CDL_CHR_DRAWN;
+  FILE* file = tmpfile();
+  assert(cdl_save(file) == 0);
+  assert((size_t) ftell(file) == cartridge.prg_size + cartridge.chr_size);
+  rewind(file);
+  cdl_reset();
+  assert(cdl_load(file) == 0);
+  assert(cdl_prg[cdl_prg_size - 1] == CDL_DATA);
+  assert(cdl_chr[0x0100] == CDL_CHR_DRAWN);
+  fclose(file);
+  free(rom);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_heatmap()
+{
+  /* Set up */
+  initialize_cpu();
+  heatmap_reset();
+
+  /* Test */
+
+#ifdef HEATMAP
+  /* Reads, writes and executes are counted against their page */
+  write(0x0301, 0x22);
+  READ(0x0301);
+  READ(0x03FF);
+  perform_instruction(0x08, 0x8000);
+  assert(heatmap[0x03][heatmap_read] == 2);
+  assert(heatmap[0x03][heatmap_write] == 1);
+  assert(heatmap[0x80][heatmap_execute] == 1);
+#endif
+
+  /* Frame export is little endian and clears the counters */
+  heatmap[0x12][heatmap_write] = 0x01020304;
+  FILE* file = tmpfile();
+  assert(heatmap_end_frame(file) == 0);
+  assert(heatmap[0x12][heatmap_write] == 0);
+  assert(ftell(file) == HEATMAP_PAGES * 3 * 4);
+  uint8_t bytes[4];
+  fseek(file, (0x12 * 3 + heatmap_write) * 4, SEEK_SET);
+  assert(fread(bytes, 1, 4, file) == 4);
+  assert(bytes[0] == 0x04 && bytes[3] == 0x01);
+  fclose(file);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+/* One value of a metrics_write dump, by the start of its line */
+static uint64_t metric_value(FILE* file, const char* name)
+{
+  char text[4096];
+  char start[256];
+  unsigned long long value = 0;
+
+  rewind(file);
+  assert(metrics_write(file) == 0);
+  rewind(file);
+  text[fread(text, 1, sizeof(text) - 1, file)] = 0;
+  snprintf(start, sizeof(start), "\n%s", name);
+  const char* line = strstr(text, start);
+  assert(line && sscanf(line + strlen(start), "%llu", &value) == 1);
+  return value;
+}
+
+void test_trace()
+{
+  /* Set up */
+  initialize_cpu();
+  char json[4096];
+  FILE* file = tmpfile();
+  FILE* earlier = tmpfile();
+  assert(trace_flush(earlier) == 0);
+  fclose(earlier);
+
+  /* Test */
+
+  /* Spans are written as begin/end pairs carrying the cycle count */
+  trace_record(trace_dma, 1);
+  cycles = 513;
+  trace_record(trace_dma, 0);
+  assert(trace_flush(file) == 0);
+  rewind(file);
+  json[fread(json, 1, sizeof(json) - 1, file)] = 0;
+  assert(strstr(json, "{\"traceEvents\":[") == json);
+  assert(strstr(json, "\"name\":\"dma\",\"ph\":\"B\""));
+  assert(strstr(json, "\"ph\":\"E\""));
+  assert(strstr(json, "\"cycle\":513"));
+
+  /* Flushing empties the buffers */
+  rewind(file);
+  assert(trace_flush(file) == 0);
+  assert(ftell(file) == strlen("{\"traceEvents\":[\n]}\n"));
+  fclose(file);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
+
+void test_metrics()
+{
+  /* Set up */
+  initialize_cpu();
+  char text[4096];
+  FILE* file = tmpfile();
+
+  /* Test */
+
+#ifdef METRICS
+  /* Instructions are counted in the calling thread's slot */
+  uint64_t before = metrics_local()->counters[metric_instructions];
+  perform_instruction(0x08, 0x8000);
+  assert(metrics_local()->counters[metric_instructions] == before + 1);
+#endif
+
+  /* Frame times land in the histogram and count deadline misses */
+  uint64_t frames = metric_value(file, "nes_frames_total ");
+  uint64_t misses = metric_value(file, "nes_deadline_misses_total ");
+  uint64_t fast = metric_value(file, "nes_frame_seconds_bucket{le=\"0.0005\"} ");
+  metrics_frame(300000, 1000000);
+  metrics_frame(20000000, 16639267);
+  assert(metric_value(file, "nes_frames_total ") == frames + 2);
+  assert(metric_value(file, "nes_deadline_misses_total ") == misses + 1);
+  assert(metric_value(file, "nes_frame_seconds_bucket{le=\"0.0005\"} ") == fast + 1);
+
+#ifdef METRICS
+  /* run_frame times itself, snapshots count their bytes */
+  frames = metric_value(file, "nes_frames_total ");
+  uint64_t bytes = metric_value(file, "nes_save_state_bytes_total ");
+  uint8_t* snapshot = malloc(state_size(STATE_SNAPSHOT));
+  run_frame();
+  state_save(snapshot, STATE_SNAPSHOT);
+  assert(metric_value(file, "nes_frames_total ") == frames + 1);
+  assert(metric_value(file, "nes_save_state_bytes_total ") == bytes + state_size(STATE_SNAPSHOT));
+  free(snapshot);
+#endif
+
+  /* Scrapers get the response after their request is read */
+  char path[] = "/tmp/nes-metrics-XXXXXX";
+  struct sockaddr_un address = {AF_UNIX};
+  assert(mkdtemp(path) != NULL);
+  snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", path);
+  int listener = metrics_listen(address.sun_path);
+  int client = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(listener >= 0 && connect(client, (struct sockaddr*) &address, sizeof(address)) == 0);
+  assert(send(client, "GET /metrics HTTP/1.0\r\n\r\n", 26, 0) == 26);
+  metrics_poll(listener);
+  text[recv(client, text, sizeof(text) - 1, MSG_WAITALL)] = 0;
+  assert(strstr(text, "HTTP/1.0 200 OK\r\n") == text && strstr(text, "nes_frames_total "));
+
+  /* and one that hangs up early cannot take the process down with SIGPIPE */
+  FILE* hangup = fdopen(socket(AF_UNIX, SOCK_STREAM, 0), "r");
+  assert(connect(fileno(hangup), (struct sockaddr*) &address, sizeof(address)) == 0);
+  assert(send(fileno(hangup), "GET / HTTP/1.0\r\n\r\n", 18, 0) == 18);
+  fclose(hangup);
+  metrics_poll(listener);
+
+  shutdown(client, SHUT_RDWR);
+  fclose(fdopen(client, "r"));
+  fclose(fdopen(listener, "r"));
+  snprintf(text, sizeof(text), "rm -rf %s", path);
+  assert(system(text) == 0);
+  fclose(file);
+
+  /* Tear down */
+  deinitialize_cpu();
+}
@@ -3,11 +3,51 @@
 
 #include "../cpu/cpu.h"
 #include "../cpu/opcodes.h"
+#include "../cpu/tables.h"
+#include "../cpu/cdl.h"
+#include "../cpu/heatmap.h"
+#include "../cpu/trace.h"
+#include "../cpu/metrics.h"
+#include "../cpu/library.h"
+#include "../cpu/vector.h"
+#include "../cpu/workers.h"
+#include "../cpu/diff.h"
+#include "../cpu/search.h"
+#include <string.h>
+#include <utime.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <assert.h>
 
 void test_addresses();
 void test_stack();
 void test_bitman();
 void test_opcodes();
+void test_dispatch();
+void test_tables();
+void test_dma();
+void test_mmc3();
+void test_mappers();
+void test_gamedb();
+void test_zip();
+void test_library();
+void test_region();
+void test_overclock();
+void test_input();
+void test_vector();
+void test_vector_async();
+void test_watchdog();
+void test_vector_state();
+void test_workers();
+void test_cheats();
+void test_hooks();
+void test_diff();
+void test_search();
+void test_cdl();
+void test_heatmap();
+void test_trace();
+void test_metrics();
 
 #endif